@@ -0,0 +1,150 @@
+#include "adaptive-mesh.hh"
+
+#include <array>
+#include <unordered_map>
+
+#include "curved-domain.hh"
+
+namespace AdaptiveMesh {
+
+namespace {
+
+  using Triangle = std::array<size_t, 3>;
+
+  // Position of a vertex on the boundary of a curved domain
+  struct BoundaryParameter {
+    bool boundary;
+    size_t curve;
+    double u;
+  };
+
+  const size_t none = (size_t)-1;
+
+  inline size_t edgeKey(size_t a, size_t b) {
+    return a < b ? (a << 32) | b : (b << 32) | a;
+  }
+
+}
+
+TriMesh eval(const Surface &surface, size_t resolution, double tolerance, size_t max_depth) {
+  Point2DVector uvs;
+  return eval(surface, resolution, tolerance, uvs, max_depth);
+}
+
+TriMesh eval(const Surface &surface, size_t resolution, double tolerance, Point2DVector &uvs,
+             size_t max_depth) {
+  auto domain = surface.domain();
+  auto curved = dynamic_cast<const CurvedDomain *>(domain.get());
+  uvs = domain->parameters(resolution);
+  PointVector points; points.reserve(uvs.size());
+  for (const auto &uv : uvs)
+    points.push_back(surface.eval(uv));
+  std::vector<Triangle> triangles;
+  for (const auto &t : domain->meshTopology(resolution).triangles())
+    triangles.push_back({ t[0], t[1], t[2] });
+
+  // The curved domain mesh starts with the boundary samples, `resolution` for each curve
+  std::vector<BoundaryParameter> params(uvs.size(), { false, 0, 0.0 });
+  if (curved)
+    for (size_t i = 0, n = curved->boundaries().size(); i < n * resolution; ++i)
+      params[i] = { true, i / resolution, (double)(i % resolution) / resolution };
+
+  // Verdict for each edge: its midpoint vertex, or none when it is flat enough.
+  // Kept across the depths, so unsplit edges are evaluated only once.
+  std::unordered_map<size_t, size_t> midpoints;
+  for (size_t depth = 0; depth < max_depth; ++depth) {
+    // Count the uses of each edge, to find the boundary edges
+    std::unordered_map<size_t, size_t> uses;
+    for (const auto &t : triangles)
+      for (size_t j = 0; j < 3; ++j)
+        ++uses[edgeKey(t[j], t[(j+1)%3])];
+
+    // Split the edges whose midpoint deviates from the chord
+    std::vector<size_t> split;
+    for (const auto &t : triangles)
+      for (size_t j = 0; j < 3; ++j) {
+        size_t a = t[j], b = t[(j+1)%3], key = edgeKey(a, b);
+        if (midpoints.count(key))
+          continue;
+        Point2D uv = (uvs[a] + uvs[b]) / 2.0;
+        BoundaryParameter param = { false, 0, 0.0 };
+        if (curved && uses[key] == 1 && params[a].boundary && params[b].boundary) {
+          // Follow the boundary curve instead of the chord;
+          // an edge between two curves belongs to the one ending at the corner
+          size_t n = curved->boundaries().size();
+          bool owner_a = params[a].curve == params[b].curve ||
+            (params[a].curve + 1) % n == params[b].curve;
+          const auto &pa = owner_a ? params[a] : params[b];
+          const auto &pb = owner_a ? params[b] : params[a];
+          double u = (pa.u + (pb.curve == pa.curve ? pb.u : 1.0)) / 2.0;
+          auto p = curved->boundaries()[pa.curve].eval(u);
+          uv = Point2D(p[0], p[1]);
+          param = { true, pa.curve, u };
+        }
+        auto p = surface.eval(uv);
+        if ((p - (points[a] + points[b]) / 2.0).norm() <= tolerance) {
+          midpoints[key] = none;
+          continue;
+        }
+        midpoints[key] = uvs.size();
+        split.push_back(key);
+        uvs.push_back(uv);
+        points.push_back(p);
+        params.push_back(param);
+      }
+
+    std::vector<Triangle> refined; refined.reserve(triangles.size() * 2);
+    bool changed = false;
+    for (const auto &t : triangles) {
+      std::array<size_t, 3> m;
+      size_t marked = 0;
+      for (size_t j = 0; j < 3; ++j) {
+        m[j] = midpoints[edgeKey(t[j], t[(j+1)%3])];
+        if (m[j] != none)
+          ++marked;
+      }
+      if (marked == 0) {
+        refined.push_back(t);
+        continue;
+      }
+      changed = true;
+      if (marked == 3) {
+        refined.push_back({ t[0], m[0], m[2] });
+        refined.push_back({ m[0], t[1], m[1] });
+        refined.push_back({ m[2], m[1], t[2] });
+        refined.push_back({ m[0], m[1], m[2] });
+        continue;
+      }
+      // Rotate so that the first edge is split, and (for two splits) the last one is not
+      size_t r = 0;
+      if (marked == 1)
+        while (m[r] == none)
+          ++r;
+      else
+        while (m[(r+2)%3] != none)
+          ++r;
+      size_t a = t[r], b = t[(r+1)%3], c = t[(r+2)%3], mab = m[r], mbc = m[(r+1)%3];
+      if (marked == 1) {
+        refined.push_back({ a, mab, c });
+        refined.push_back({ mab, b, c });
+      } else {
+        refined.push_back({ mab, b, mbc });
+        refined.push_back({ a, mab, mbc });
+        refined.push_back({ a, mbc, c });
+      }
+    }
+    triangles.swap(refined);
+    for (size_t key : split)
+      midpoints.erase(key);     // these edges are gone
+    if (!changed)
+      break;
+  }
+
+  TriMesh mesh;
+  mesh.setPoints(points);
+  for (const auto &t : triangles)
+    mesh.addTriangle(t[0], t[1], t[2]);
+  return mesh;
+}
+
+}
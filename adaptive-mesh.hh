@@ -0,0 +1,19 @@
+#pragma once
+
+#include <surface.hh>
+
+namespace AdaptiveMesh {
+
+using namespace Geometry;
+using Transfinite::Surface;
+
+// Evaluates the surface on the domain mesh of the given (coarse) resolution, then refines
+// the triangles where the surface deviates from the flat triangle by more than `tolerance`.
+// Refinement splits the deviating edges at their midpoints (red-green style),
+// so the mesh stays conforming. The vertices of the coarse mesh keep their indices.
+TriMesh eval(const Surface &surface, size_t resolution, double tolerance, size_t max_depth = 8);
+// Also returns the domain point of each vertex
+TriMesh eval(const Surface &surface, size_t resolution, double tolerance, Point2DVector &uvs,
+             size_t max_depth = 8);
+
+}
@@ -13,30 +13,72 @@ ConstrainedHarmonic::ConstrainedHarmonic(size_t levels) : Harmonic(levels) {
 ConstrainedHarmonic::~ConstrainedHarmonic() {
 }
 
+namespace {
+
+  // As in Surface::blendSideSingular
+  DoubleVector blendSides(const DoubleVector &weights) {
+    DoubleVector blends;
+    size_t small = 0;
+    for (const auto &w : weights)
+      if (w < epsilon)
+        ++small;
+    if (small > 0) {
+      double val = 1.0 / small;
+      for (const auto &w : weights)
+        blends.push_back(w < epsilon ? val : 0.0);
+    } else {
+      double denominator = 0.0;
+      for (const auto &w : weights) {
+        blends.push_back(std::pow(w, -2));
+        denominator += blends.back();
+      }
+      std::transform(blends.begin(), blends.end(), blends.begin(),
+                     [denominator](double x) { return x / denominator; });
+    }
+    return blends;
+  }
+
+}
+
 Point2D
 ConstrainedHarmonic::mapToRibbon(size_t i, const Point2D &uv) const {
   Point2D sd = Harmonic::mapToRibbon(     i , uv);
   double s_1 = Harmonic::mapToRibbon(prev(i), uv)[0];
   double s1  = Harmonic::mapToRibbon(next(i), uv)[0];
 
-  // As in Surface::blendSideSingular
-  std::vector<double> blends, weights = { sd[1], 1.0 - sd[0], 1.0 - sd[1], sd[0] };
-  size_t small = 0;
-  for (const auto &w : weights)
-    if (w < epsilon)
-      ++small;
-  if (small > 0) {
-    double val = 1.0 / small;
-    for (const auto &w : weights)
-      blends.push_back(w < epsilon ? val : 0.0);
-  } else {
-    double denominator = 0.0;
-    for (const auto &w : weights) {
-      blends.push_back(std::pow(w, -2));
-      denominator += blends.back();
+  auto blends = blendSides({ sd[1], 1.0 - sd[0], 1.0 - sd[1], sd[0] });
+
+  sd[1] = sd[1] * (blends[0] + blends[2]) + s1 * blends[1] + (1.0 - s_1) * blends[3];
+  return sd;
+}
+
+Point2D
+ConstrainedHarmonic::mapToRibbonDerivatives(size_t i, const Point2D &uv,
+                                            Vector2DVector &der) const {
+  Vector2DVector der_1, der1;
+  Point2D sd = Harmonic::mapToRibbonDerivatives(     i , uv, der);
+  double s_1 = Harmonic::mapToRibbonDerivatives(prev(i), uv, der_1)[0];
+  double s1  = Harmonic::mapToRibbonDerivatives(next(i), uv, der1)[0];
+
+  DoubleVector weights = { sd[1], 1.0 - sd[0], 1.0 - sd[1], sd[0] };
+  auto blends = blendSides(weights);
+  bool singular = std::any_of(weights.begin(), weights.end(),
+                              [](double w) { return w < epsilon; });
+
+  for (size_t k = 0; k < 2; ++k) {
+    double ds = der[k][0], dd = der[k][1];
+    // Derivatives of the blends w_j^-2 / sum_l w_l^-2 (constant in the singular case)
+    DoubleVector dweights = { dd, -ds, -dd, ds }, dblends(4, 0.0);
+    if (!singular) {
+      double mean = 0.0;
+      for (size_t j = 0; j < 4; ++j)
+        mean += blends[j] * dweights[j] / weights[j];
+      for (size_t j = 0; j < 4; ++j)
+        dblends[j] = -2.0 * blends[j] * (dweights[j] / weights[j] - mean);
     }
-    std::transform(blends.begin(), blends.end(), blends.begin(),
-                   [denominator](double x) { return x / denominator; });
+    der[k][1] = dd * (blends[0] + blends[2]) + sd[1] * (dblends[0] + dblends[2])
+      + der1[k][0] * blends[1] + s1 * dblends[1]
+      - der_1[k][0] * blends[3] + (1.0 - s_1) * dblends[3];
   }
 
   sd[1] = sd[1] * (blends[0] + blends[2]) + s1 * blends[1] + (1.0 - s_1) * blends[3];
@@ -7,4 +7,6 @@ public:
   ConstrainedHarmonic(size_t levels);
   virtual ~ConstrainedHarmonic();
   virtual Point2D mapToRibbon(size_t i, const Point2D &uv) const override;
+  virtual Point2D mapToRibbonDerivatives(size_t i, const Point2D &uv,
+                                         Vector2DVector &der) const override;
 };
@@ -0,0 +1,96 @@
+#include "curve-sampler.hh"
+
+#include <algorithm>
+
+namespace CurveSampler {
+
+namespace {
+
+  const size_t block_size = 8;
+
+  // Basis functions of degree p in span k (Piegl-Tiller, A2.2) for `count` parameters at once.
+  // The arrays are stored by function index, then by parameter: N[j * block_size + b]
+  void basisFunctions(size_t k, size_t p, const DoubleVector &knots, const double *us,
+                      size_t count, DoubleVector &N, DoubleVector &left, DoubleVector &right) {
+    for (size_t b = 0; b < count; ++b)
+      N[b] = 1.0;
+    for (size_t j = 1; j <= p; ++j) {
+      double *lj = &left[j * block_size], *rj = &right[j * block_size];
+      for (size_t b = 0; b < count; ++b) {
+        lj[b] = us[b] - knots[k+1-j];
+        rj[b] = knots[k+j] - us[b];
+      }
+      double saved[block_size] = { 0.0 };
+      for (size_t r = 0; r < j; ++r) {
+        double *Nr = &N[r * block_size];
+        const double *rr = &right[(r + 1) * block_size], *lr = &left[(j - r) * block_size];
+        for (size_t b = 0; b < count; ++b) {
+          double tmp = Nr[b] / (rr[b] + lr[b]);
+          Nr[b] = saved[b] + rr[b] * tmp;
+          saved[b] = lr[b] * tmp;
+        }
+      }
+      double *Nj = &N[j * block_size];
+      for (size_t b = 0; b < count; ++b)
+        Nj[b] = saved[b];
+    }
+  }
+
+}
+
+void eval(const BSCurve &curve, const DoubleVector &us, PointVector &points) {
+  size_t p = curve.degree();
+  const auto &knots = curve.knots();
+  const auto &cp = curve.controlPoints();
+  size_t n = cp.size() - 1;     // last control point index = last span
+  points.resize(us.size());
+
+  DoubleVector N((p + 1) * block_size), left((p + 1) * block_size), right((p + 1) * block_size);
+  double us_block[block_size], x[block_size], y[block_size], z[block_size];
+  size_t k = p;
+  for (size_t i = 0; i < us.size(); ) {
+    // Span of us[i], clamped to the valid range
+    double u = std::clamp(us[i], knots[p], knots[n+1]);
+    if (u < knots[k])
+      k = p;
+    while (k < n && u >= knots[k+1])
+      ++k;
+
+    // The following parameters in the same span
+    size_t count = 0;
+    for (; count < block_size && i + count < us.size(); ++count) {
+      double v = std::clamp(us[i+count], knots[p], knots[n+1]);
+      if (v < knots[k] || (k < n && v >= knots[k+1]))
+        break;
+      us_block[count] = v;
+    }
+
+    basisFunctions(k, p, knots, us_block, count, N, left, right);
+    for (size_t b = 0; b < count; ++b)
+      x[b] = y[b] = z[b] = 0.0;
+    for (size_t j = 0; j <= p; ++j) {
+      const auto &q = cp[k-p+j];
+      const double *Nj = &N[j * block_size];
+      for (size_t b = 0; b < count; ++b) {
+        x[b] += Nj[b] * q[0];
+        y[b] += Nj[b] * q[1];
+        z[b] += Nj[b] * q[2];
+      }
+    }
+    for (size_t b = 0; b < count; ++b)
+      points[i+b] = Point3D(x[b], y[b], z[b]);
+    i += count;
+  }
+}
+
+DoubleVector uniform(size_t resolution, bool include_end) {
+  DoubleVector us;
+  us.reserve(resolution + 1);
+  for (size_t k = 0; k < resolution; ++k)
+    us.push_back((double)k / resolution);
+  if (include_end)
+    us.push_back(1.0);
+  return us;
+}
+
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <geometry.hh>
+
+namespace CurveSampler {
+
+using namespace Geometry;
+
+// Points of the curve at the parameters `us`, written into `points` (resized as needed).
+// Sorted parameters are fastest: the knot span is located incrementally, and the basis
+// functions are computed for blocks of parameters in the same span at once.
+void eval(const BSCurve &curve, const DoubleVector &us, PointVector &points);
+
+// Parameters k / resolution for k = 0 .. resolution - 1, and also 1 if `include_end` is set
+DoubleVector uniform(size_t resolution, bool include_end);
+
+}
@@ -1,13 +1,10 @@
 #include "curved-cb.hh"
 
-#include <ribbon-perpendicular.hh>
-
 #include "curved-domain.hh"
 #include "harmonic.hh"
 
 using DomainType = CurvedDomain;
 using ParamType = Harmonic;
-using RibbonType = Transfinite::RibbonPerpendicular;
 
 CurvedCB::CurvedCB() {
   domain_ = std::make_shared<DomainType>();
@@ -18,17 +15,10 @@ CurvedCB::CurvedCB() {
 CurvedCB::~CurvedCB() {
 }
 
-Point3D
-CurvedCB::eval(const Point2D &uv) const {
-  Point2DVector sds = param_->mapToRibbons(uv);
-  DoubleVector blends = blendCorner(sds);
-  Point3D p(0,0,0);
+PointVector
+CurvedCB::cornerTerms(const Point2DVector &sds) const {
+  PointVector terms; terms.reserve(n_);
   for (size_t i = 0; i < n_; ++i)
-    p += cornerInterpolant(i, sds) * blends[i];
-  return p;
-}
-
-std::shared_ptr<Ribbon>
-CurvedCB::newRibbon() const {
-  return std::make_shared<RibbonType>();
+    terms.push_back(cornerInterpolant(i, sds));
+  return terms;
 }
@@ -1,6 +1,5 @@
 #include "curved-cr.hh"
 
-#include <ribbon-perpendicular.hh>
 #include <utilities.hh>
 
 #include "curved-domain.hh"
@@ -8,7 +7,6 @@
 
 using DomainType = CurvedDomain;
 using ParamType = Harmonic;
-using RibbonType = Transfinite::RibbonPerpendicular;
 
 CurvedCR::CurvedCR() {
   domain_ = std::make_shared<DomainType>();
@@ -19,19 +17,16 @@ CurvedCR::CurvedCR() {
 CurvedCR::~CurvedCR() {
 }
 
-Point3D
-CurvedCR::eval(const Point2D &uv) const {
-  Point2DVector sds = param_->mapToRibbons(uv);
-  DoubleVector blends = blendCorner(sds);
-  Point3D p(0,0,0);
+PointVector
+CurvedCR::cornerTerms(const Point2DVector &sds) const {
+  // Ribbon i is blended with (B_i + B_{i-1}) / 2, so B_i multiplies ribbons i and i+1
+  PointVector ribbons; ribbons.reserve(n_);
   for (size_t i = 0; i < n_; ++i)
-    p += compositeRibbon(i, sds[i]) * (blends[i] + blends[prev(i)]);
-  return p * 0.5;
-}
-
-std::shared_ptr<Ribbon>
-CurvedCR::newRibbon() const {
-  return std::make_shared<RibbonType>();
+    ribbons.push_back(compositeRibbon(i, sds[i]));
+  PointVector terms; terms.reserve(n_);
+  for (size_t i = 0; i < n_; ++i)
+    terms.push_back((ribbons[i] + ribbons[next(i)]) * 0.5);
+  return terms;
 }
 
 Point3D
@@ -1,21 +1,15 @@
 #pragma once
 
-#include <surface.hh>
+#include "curved-surface.hh"
 
-using namespace Geometry;
-using Transfinite::Ribbon;
-using Transfinite::Surface;
-
-class CurvedCR : public Surface {
+class CurvedCR : public CurvedSurface {
 public:
   CurvedCR();
   CurvedCR(const CurvedCR &) = default;
   virtual ~CurvedCR();
   CurvedCR &operator=(const CurvedCR &) = default;
-  virtual Point3D eval(const Point2D &uv) const override;
-  using Surface::eval;
 
 protected:
-  virtual std::shared_ptr<Ribbon> newRibbon() const override;
+  virtual PointVector cornerTerms(const Point2DVector &sds) const override;
   Point3D compositeRibbon(size_t i, const Point2D &sd) const;
 };
@@ -1,5 +1,6 @@
 #include "curved-domain.hh"
 
+#include <mutex>
 #include <sstream>
 
 #define ANSI_DECLARATORS
@@ -9,9 +10,11 @@ extern "C" {
 #include <triangle.h>
 }
 
+#include "curve-sampler.hh"
+#include "grid-mesher.hh"
 #include "lsq-plane.hh"
 
-CurvedDomain::CurvedDomain() : mesh_updated(false) {
+CurvedDomain::CurvedDomain() : mesher_(Mesher::TRIANGLE), mesh_updated(false), mesh_resolution_(0) {
 }
 
 CurvedDomain::~CurvedDomain() {
@@ -71,17 +74,47 @@ CurvedDomain::update() {
 
 void
 CurvedDomain::updateMesh(size_t resolution) {
-  DoubleVector points;
+  Point2DVector boundary;
+  auto us = CurveSampler::uniform(resolution, false);
+  PointVector points;
   for (const auto &c : plane_curves_) {
-    for (size_t i = 0; i < resolution; ++i) {
-      double u = (double)i / resolution;
-      auto p = c.eval(u);
-      points.push_back(p[0]);
-      points.push_back(p[1]);
-    }
+    CurveSampler::eval(c, us, points);
+    for (const auto &p : points)
+      boundary.emplace_back(p[0], p[1]);
+  }
+
+  double edge_length = 0.0;
+  for (const auto &c : plane_curves_)
+    edge_length = std::max(edge_length, c.arcLength(0.0, 1.0));
+  edge_length /= resolution * 2;
+
+  parameters_.clear();
+  mesh_ = TriMesh();
+  if (mesher_ != Mesher::GRID || !gridMesh(boundary, edge_length))
+    triangleMesh(boundary, edge_length);
+
+  mesh_updated = true;
+  mesh_resolution_ = resolution;
+
+  // Domain test:
+  if (false) {
+    PointVector pv;
+    for (const auto &p : parameters_)
+      pv.emplace_back(p[0], p[1], 0.0);
+    mesh_.setPoints(pv);
+    mesh_.writeOBJ("/tmp/domain.obj");
+  }
+}
+
+void
+CurvedDomain::triangleMesh(const Point2DVector &boundary, double edge_length) {
+  DoubleVector points;
+  for (const auto &p : boundary) {
+    points.push_back(p[0]);
+    points.push_back(p[1]);
   }
   std::vector<int> segments;
-  int n = points.size() / 2;
+  int n = boundary.size();
   for (int i = 0; i < n; ++i) {
     segments.push_back(i);
     segments.push_back(i + 1);
@@ -109,13 +142,11 @@ CurvedDomain::updateMesh(size_t resolution) {
   out.segmentlist = nullptr;
   out.segmentmarkerlist = nullptr;
 
-  double max_area = 0.0;
-  for (const auto &c : plane_curves_)
-    max_area = std::max(max_area, c.arcLength(0.0, 1.0));
-  max_area /= resolution * 2;
-  max_area *= max_area * std::sqrt(3.0) / 4.0;
+  double max_area = edge_length * edge_length * std::sqrt(3.0) / 4.0;
   std::stringstream cmd;
   cmd << "pq30a" << std::fixed << max_area << "DBPzQ";
+  static std::mutex triangle_mutex; // Triangle keeps global state
+  std::lock_guard<std::mutex> lock(triangle_mutex);
   triangulate(const_cast<char *>(cmd.str().c_str()), &in, &out, (struct triangulateio *)nullptr);
 
   for (int i = 0; i < out.numberofpoints; ++i)
@@ -125,29 +156,33 @@ CurvedDomain::updateMesh(size_t resolution) {
     mesh_.addTriangle(out.trianglelist[3*i+2],
                       out.trianglelist[3*i+1],
                       out.trianglelist[3*i+0]);
+}
 
-  mesh_updated = true;
-
-  // Domain test:
-  if (false) {
-    PointVector pv;
-    for (const auto &p : parameters_)
-      pv.emplace_back(p[0], p[1], 0.0);
-    mesh_.setPoints(pv);
-    mesh_.writeOBJ("/tmp/domain.obj");
-  }
+bool
+CurvedDomain::gridMesh(const Point2DVector &boundary, double edge_length) {
+  Point2DVector vertices;
+  std::vector<GridMesher::Triangle> triangles;
+  if (!GridMesher::triangulate(boundary, edge_length, vertices, triangles))
+    return false;
+
+  // Same orientation as the Triangle output
+  parameters_ = vertices;
+  mesh_.resizePoints(parameters_.size());
+  for (const auto &t : triangles)
+    mesh_.addTriangle(t[2], t[1], t[0]);
+  return true;
 }
 
 const Point2DVector &
 CurvedDomain::parameters(size_t resolution) const {
-  if (!mesh_updated)
+  if (!mesh_updated || mesh_resolution_ != resolution)
     const_cast<CurvedDomain *>(this)->updateMesh(resolution);
   return parameters_;
 }
 
 TriMesh
 CurvedDomain::meshTopology(size_t resolution) const {
-  if (!mesh_updated)
+  if (!mesh_updated || mesh_resolution_ != resolution)
     const_cast<CurvedDomain *>(this)->updateMesh(resolution);
   return mesh_;
 }
@@ -157,3 +192,21 @@ CurvedDomain::boundaries() const {
   return plane_curves_;
 }
 
+void
+CurvedDomain::setMesher(Mesher mesher) {
+  mesher_ = mesher;
+  mesh_updated = false;
+}
+
+CurvedDomain::Mesher
+CurvedDomain::mesher() const {
+  return mesher_;
+}
+
+MemoryUsage
+CurvedDomain::memoryUsage() const {
+  MemoryUsage usage;
+  usage.meshes = parameters_.capacity() * sizeof(Point2D) +
+    mesh_.points().size() * sizeof(Point3D) + mesh_.triangles().size() * 3 * sizeof(size_t);
+  return usage;
+}
@@ -2,21 +2,38 @@
 
 #include <domain.hh>
 
+#include "memory-usage.hh"
+
 using namespace Geometry;
 using Transfinite::Domain;
 
 class CurvedDomain : public Domain {
 public:
+  // Triangulation of the domain:
+  // - TRIANGLE: constrained Delaunay, quality mesh by Triangle
+  // - GRID: regular grid inside, stitched to the boundary samples; no global state,
+  //   so domains can be meshed in parallel. Falls back to Triangle when the
+  //   clipped grid is not simply connected (e.g. very narrow domains).
+  enum class Mesher { TRIANGLE, GRID };
+
   CurvedDomain();
   virtual ~CurvedDomain();
   virtual bool update() override;
   virtual const Point2DVector &parameters(size_t resolution) const override;
+  // The first vertices are the boundary samples: `resolution` per curve, at u = k / resolution
   virtual TriMesh meshTopology(size_t resolution) const override;
   const std::vector<BSCurve> &boundaries() const;
+  void setMesher(Mesher mesher); // takes effect in the next meshing
+  Mesher mesher() const;
+  MemoryUsage memoryUsage() const; // the current domain mesh
 private:
   void updateMesh(size_t resolution);
+  void triangleMesh(const Point2DVector &boundary, double edge_length);
+  bool gridMesh(const Point2DVector &boundary, double edge_length);
 
+  Mesher mesher_;
   bool mesh_updated;
+  size_t mesh_resolution_;
   std::vector<BSCurve> plane_curves_;
   Point2DVector parameters_;
   TriMesh mesh_;
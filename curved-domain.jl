@@ -2,6 +2,7 @@ module CurvedDomain
 
 import Graphics
 using Gtk
+using Mmap
 
 curves = []
 density = 0.1
@@ -16,26 +17,25 @@ affine_combine(p, x, q) = p * (1 - x) + q * x
 
 function generate_curves()
     global curves = []
-    vert = mesh[1]
-    tri = mesh[2]
+    V, T = mesh
     for param in 1:length(sd)
         !sd[param] && continue
         function slice(i, j)
-            x, y = vert[i][param], vert[j][param]
+            x, y = V[param, i], V[param, j]
             if y > x
                 x, y = y, x
                 i, j = j, i
             end
             q1 = div(x, density)
             q2 = div(y, density)
-            q1 - q2 == 1 && q1 <= nrlines && affine_combine(vert[j][end-1:end],
+            q1 - q2 == 1 && q1 <= nrlines && affine_combine(V[end-1:end, j],
                                                             (density * q1 - y) / (x - y),
-                                                            vert[i][end-1:end])
+                                                            V[end-1:end, i])
         end
-        foreach(tri) do t
-            ab = slice(t[1], t[2])
-            ac = slice(t[1], t[3])
-            bc = slice(t[2], t[3])
+        foreach(eachcol(T)) do t
+            ab = slice(t[1] + 1, t[2] + 1)
+            ac = slice(t[1] + 1, t[3] + 1)
+            bc = slice(t[2] + 1, t[3] + 1)
             lst = filter(x -> x != false, [ab, ac, bc])
             if length(lst) == 2
                 push!(curves, (lst[1], lst[2]))
@@ -62,9 +62,9 @@ function draw_polygon(ctx, poly, closep = false)
 end
 
 function draw_mesh(ctx)
-    v = mesh[1]
-    for tri in mesh[2]
-        draw_polygon(ctx, map(p -> scaling(p[end-1:end]), [v[tri[1]], v[tri[2]], v[tri[3]]]), true)
+    V, T = mesh
+    for tri in eachcol(T)
+        draw_polygon(ctx, map(k -> scaling(V[end-1:end, k+1]), tri), true)
     end
 end
 
@@ -98,9 +98,11 @@ end
     draw_segments(ctx, map(s -> map(scaling, s), curves))
 end
 
+# The meshes are (V, T): the vertex data in columns (s_1 d_1 ... s_n d_n u v),
+# and the 0-based vertex indices of the triangles in columns.
 function readOBJ(filename)
-    vertices = []
-    triangles = []
+    vertices = Vector{Float64}[]
+    triangles = Vector{Int}[]
     open(filename) do f
         for line in eachline(f)
             parts = split(line)
@@ -108,19 +110,34 @@ function readOBJ(filename)
                 p = map(s -> parse(Float64, s), parts[2:end])
                 push!(vertices, p)
             elseif parts[1] == "f"
-                tri = map(s -> parse(Int, s), parts[2:end])
+                tri = map(s -> parse(Int, s) - 1, parts[2:end])
                 push!(triangles, tri)
             end
         end
     end
-    (vertices, triangles)
+    (reduce(hcat, vertices), reduce(hcat, triangles))
+end
+
+# Binary parameter fields, as written by curved-patch (see writeDomainBinary).
+# The matrices are memory-mapped, so this assumes a little-endian host.
+function readbinary(filename)
+    open(filename) do f
+        read(f, 4) == b"CPSD" || error("Not a parameter field file: $filename")
+        version, n, nv, nt = [Int(ltoh(read(f, UInt32))) for _ in 1:4]
+        version == 1 || error("Unsupported version: $version")
+        header = 20
+        V = Mmap.mmap(f, Matrix{Float32}, (2n + 2, nv), header)
+        T = Mmap.mmap(f, Matrix{UInt32}, (3, nt), header + 4 * (2n + 2) * nv)
+        (V, T)
+    end
 end
 
 function run(filename)
-    global mesh = readOBJ(filename)
+    global mesh = endswith(filename, ".bin") ? readbinary(filename) : readOBJ(filename)
 
-    bboxu = extrema(map(p -> p[end-1], mesh[1]))
-    bboxv = extrema(map(p -> p[end], mesh[1]))
+    V = mesh[1]
+    bboxu = extrema(view(V, size(V, 1) - 1, :))
+    bboxv = extrema(view(V, size(V, 1), :))
     bblength = max(bboxu[2] - bboxu[1], bboxv[2] - bboxv[1])
     start = [bboxu[1], bboxv[1]]
     global scaling = p -> (p - start) * scale / bblength
@@ -136,7 +153,7 @@ function run(filename)
     hbox = GtkBox(:h)
     push!(vbox, hbox)
 
-    n = Int(length(mesh[1][1]) / 2 - 1)
+    n = div(size(V, 1), 2) - 1
     global sd = [false for _ in 1:2n]
     for i in 1:n
         cb = GtkCheckButton("s$i")
@@ -1,13 +1,10 @@
 #include "curved-gc.hh"
 
-#include <ribbon-perpendicular.hh>
-
 #include "curved-domain.hh"
 #include "constrained-harmonic.hh"
 
 using DomainType = CurvedDomain;
 using ParamType = ConstrainedHarmonic;
-using RibbonType = Transfinite::RibbonPerpendicular;
 
 CurvedGC::CurvedGC() {
   domain_ = std::make_shared<DomainType>();
@@ -18,20 +15,16 @@ CurvedGC::CurvedGC() {
 CurvedGC::~CurvedGC() {
 }
 
-Point3D
-CurvedGC::eval(const Point2D &uv) const {
-  Point2DVector sds = param_->mapToRibbons(uv);
-  DoubleVector blends = blendCorner(sds);
-  Point3D p(0,0,0);
+PointVector
+CurvedGC::cornerTerms(const Point2DVector &sds) const {
+  // Side i is blended with B_i + B_{i-1}, so B_i multiplies sides i and i+1
+  PointVector sides; sides.reserve(n_);
+  for (size_t i = 0; i < n_; ++i)
+    sides.push_back(sideInterpolant(i, sds[i][0], sds[i][1]));
+  PointVector terms; terms.reserve(n_);
   for (size_t i = 0; i < n_; ++i) {
-    double s = sds[i][0], d = sds[i][1], s1 = sds[next(i)][0];
-    p += sideInterpolant(i, s, d) * (blends[i] + blends[prev(i)]);
-    p -= cornerCorrection(i, 1.0 - s, s1) * blends[i];
+    double s = sds[i][0], s1 = sds[next(i)][0];
+    terms.push_back(sides[i] + sides[next(i)] - cornerCorrection(i, 1.0 - s, s1));
   }
-  return p;
-}
-
-std::shared_ptr<Ribbon>
-CurvedGC::newRibbon() const {
-  return std::make_shared<RibbonType>();
+  return terms;
 }
@@ -1,20 +1,14 @@
 #pragma once
 
-#include <surface.hh>
+#include "curved-surface.hh"
 
-using namespace Geometry;
-using Transfinite::Ribbon;
-using Transfinite::Surface;
-
-class CurvedGC : public Surface {
+class CurvedGC : public CurvedSurface {
 public:
   CurvedGC();
   CurvedGC(const CurvedGC &) = default;
   virtual ~CurvedGC();
   CurvedGC &operator=(const CurvedGC &) = default;
-  virtual Point3D eval(const Point2D &uv) const override;
-  using Surface::eval;
 
 protected:
-  virtual std::shared_ptr<Ribbon> newRibbon() const override;
+  virtual PointVector cornerTerms(const Point2DVector &sds) const override;
 };
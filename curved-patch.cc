@@ -1,8 +1,17 @@
 #include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <cstdint>
 #include <cstdlib>
+#include <cstring>
+#include <filesystem>
 #include <fstream>
+#include <functional>
 #include <iostream>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
 
 #include <domain.hh>
 #include <parameterization.hh>
@@ -10,10 +19,19 @@
 #include <surface-corner-based.hh>
 #include <surface-generalized-coons.hh>
 
+#include "adaptive-mesh.hh"
+#include "curve-sampler.hh"
+#include "constrained-harmonic.hh"
 #include "curved-cb.hh"
 #include "curved-cr.hh"
+#include "curved-domain.hh"
 #include "curved-gc.hh"
+#include "curved-surface.hh"
+#include "fem-harmonic.hh"
+#include "harmonic.hh"
+#include "output-queue.hh"
 #include "perpendicular-cb.hh"
+#include "projection.hh"
 
 CurveVector readLOP(std::string filename) {
   size_t n, deg, nk, nc;
@@ -40,17 +58,25 @@ CurveVector readLOP(std::string filename) {
   return result;
 }
 
-void ribbonTest(const std::shared_ptr<Surface> &surf, size_t resolution, std::string filename) {
+// Approximate memory held by a mesh waiting in the output queue
+size_t meshBytes(const TriMesh &mesh) {
+  return mesh.points().size() * sizeof(Point3D) + mesh.triangles().size() * 3 * sizeof(size_t);
+}
+
+void ribbonTest(const std::shared_ptr<Surface> &surf, size_t resolution, std::string filename,
+                OutputQueue &output) {
   double ribbon_length = 0.25;
 
   size_t n = surf->domain()->size();
   TriMesh ribbon_mesh;
   PointVector pv; pv.reserve(n * (resolution + 1) * 2);
+  auto us = CurveSampler::uniform(resolution, true);
+  PointVector points;
   for (size_t i = 0; i < n; ++i) {
+    CurveSampler::eval(*surf->ribbon(i)->curve(), us, points);
     for (size_t j = 0; j <= resolution; ++j) {
-      double u = (double)j / resolution;
-      pv.push_back(surf->ribbon(i)->curve()->eval(u));
-      pv.push_back(surf->ribbon(i)->eval(Point2D(u, ribbon_length)));
+      pv.push_back(points[j]);
+      pv.push_back(surf->ribbon(i)->eval(Point2D(us[j], ribbon_length)));
     }
   }
   ribbon_mesh.setPoints(pv);
@@ -64,16 +90,19 @@ void ribbonTest(const std::shared_ptr<Surface> &surf, size_t resolution, std::st
     }
     index += 2;
   }
-  ribbon_mesh.writeOBJ(filename);  
+  size_t bytes = meshBytes(ribbon_mesh);
+  output.push(bytes, [mesh = std::move(ribbon_mesh), filename]() { mesh.writeOBJ(filename); });
 }
 
 void fixMesh(TriMesh &mesh, const CurveVector &cv, size_t resolution) {
   size_t index = 0;
-  for (const auto &c : cv)
-    for (size_t i = 0; i < resolution; ++i) {
-      double u = (double)i / resolution;
-      mesh[index++] = c->eval(u);
-    }
+  auto us = CurveSampler::uniform(resolution, false);
+  PointVector points;
+  for (const auto &c : cv) {
+    CurveSampler::eval(*c, us, points);
+    for (const auto &p : points)
+      mesh[index++] = p;
+  }
 }
 
 std::vector<std::pair<Point3D, Point3D>>
@@ -112,18 +141,7 @@ slicer(const TriMesh &mesh, const std::vector<Point2DVector> &params) {
   return result;
 }
 
-void
-domainEval3D(const std::shared_ptr<Surface> &surf, size_t resolution, std::string filename) {
-  auto mesh = surf->domain()->meshTopology(resolution);
-  auto uvs = surf->domain()->parameters(resolution);
-  std::vector<Point2DVector> params; params.reserve(uvs.size());
-  std::transform(uvs.begin(), uvs.end(), std::back_inserter(params),
-                 [&](const Point2D &uv) { return surf->parameterization()->mapToRibbons(uv); });
-  PointVector points; points.reserve(uvs.size());
-  std::transform(uvs.begin(), uvs.end(), std::back_inserter(points),
-                 [&](const Point2D &uv) { return surf->eval(uv); });
-  mesh.setPoints(points);
-  auto segments = slicer(mesh, params);
+void writeSegments(const std::vector<std::pair<Point3D, Point3D>> &segments, std::string filename) {
   std::ofstream f(filename);
   if (!f.is_open()) {
     std::cerr << "Unable to open file: " << filename << std::endl;
@@ -138,102 +156,709 @@ domainEval3D(const std::shared_ptr<Surface> &surf, size_t resolution, std::strin
   f.close();
 }
 
+// Ribbon parameters and surface points on the vertices of the domain mesh,
+// computed once and shared by the output stages
+struct DomainEvaluation {
+  Point2DVector uvs;
+  std::vector<Point2DVector> sds;
+  TriMesh mesh;                 // with the surface points
+};
+
+std::shared_ptr<const DomainEvaluation>
+evalDomain(const std::shared_ptr<Surface> &surf, size_t resolution) {
+  auto result = std::make_shared<DomainEvaluation>();
+  result->mesh = surf->domain()->meshTopology(resolution);
+  result->uvs = surf->domain()->parameters(resolution);
+  const auto &uvs = result->uvs;
+  auto &sds = result->sds; sds.reserve(uvs.size());
+  std::transform(uvs.begin(), uvs.end(), std::back_inserter(sds),
+                 [&](const Point2D &uv) { return surf->parameterization()->mapToRibbons(uv); });
+  // Curved surfaces can be evaluated from the ribbon parameters
+  auto curved = std::dynamic_pointer_cast<CurvedSurface>(surf);
+  PointVector points; points.reserve(uvs.size());
+  for (size_t i = 0; i < uvs.size(); ++i)
+    points.push_back(curved ? curved->eval(sds[i]) : surf->eval(uvs[i]));
+  result->mesh.setPoints(points);
+  return result;
+}
+
+size_t evaluationBytes(const DomainEvaluation &evaluation) {
+  size_t n = evaluation.sds.empty() ? 0 : evaluation.sds[0].size();
+  return meshBytes(evaluation.mesh) + evaluation.uvs.size() * (n + 1) * sizeof(Point2D);
+}
+
 void
-domainEval(const std::shared_ptr<Surface> &surf, size_t resolution, std::string filename) {
-  auto mesh = surf->domain()->meshTopology(resolution);
-  auto uvs = surf->domain()->parameters(resolution);
-  std::vector<Point2DVector> points; points.reserve(uvs.size());
-  std::transform(uvs.begin(), uvs.end(), std::back_inserter(points),
-                 [&](const Point2D &uv) {
-                   auto sds = surf->parameterization()->mapToRibbons(uv);
-                   sds.push_back(uv);
-                   return sds;
-                 });
+domainEval3D(const std::shared_ptr<const DomainEvaluation> &evaluation, std::string filename,
+             OutputQueue &output) {
+  auto segments = slicer(evaluation->mesh, evaluation->sds);
+  size_t bytes = segments.size() * 2 * sizeof(Point3D);
+  output.push(bytes, [segments = std::move(segments), filename]() {
+                       writeSegments(segments, filename);
+                     });
+}
+
+void writeDomainOBJ(const DomainEvaluation &evaluation, std::string filename) {
   std::ofstream f(filename);
   if (!f.is_open()) {
     std::cerr << "Unable to open file: " << filename << std::endl;
     return;
   }
-  for (const auto &p : points) {
+  const auto &uvs = evaluation.uvs;
+  for (size_t i = 0; i < uvs.size(); ++i) {
     f << 'v';
-    for (auto coord : p)
-      f << ' ' << coord[0] << ' ' << coord[1];
-    f << std::endl;
+    for (const auto &sd : evaluation.sds[i])
+      f << ' ' << sd[0] << ' ' << sd[1];
+    f << ' ' << uvs[i][0] << ' ' << uvs[i][1] << std::endl;
   }
-  for (const auto &t : mesh.triangles())
+  for (const auto &t : evaluation.mesh.triangles())
     f << "f " << t[0] + 1 << ' ' << t[1] + 1 << ' ' << t[2] + 1 << std::endl;
   f.close();
 }
 
-void surfaceTest(std::string name, std::shared_ptr<Surface> &&surf, const CurveVector &cv,
-                 std::string filename, size_t resolution, bool fix_mesh = false) {
-  std::cout << name << ":" << std::endl;
+// Binary parameter fields for curved-domain.jl; all values are little-endian:
+//   "CPSD", version (uint32), n, #vertices, #triangles (uint32),
+//   for each vertex: s_1 d_1 ... s_n d_n u v (float32),
+//   for each triangle: 0-based vertex indices (uint32)
+void writeDomainBinary(const DomainEvaluation &evaluation, std::string filename) {
+  const uint32_t version = 1;
+  const auto &uvs = evaluation.uvs;
+  const auto &mesh = evaluation.mesh;
+  size_t n = evaluation.sds.empty() ? 0 : evaluation.sds[0].size();
+  std::vector<char> buffer;
+  buffer.reserve(20 + uvs.size() * (2 * n + 2) * 4 + mesh.triangles().size() * 12);
+  auto put = [&](uint32_t x) {
+               for (size_t i = 0; i < 4; ++i)
+                 buffer.push_back((x >> (8 * i)) & 0xff);
+             };
+  auto putFloat = [&](float x) {
+                    uint32_t bits;
+                    std::memcpy(&bits, &x, 4);
+                    put(bits);
+                  };
+  buffer.insert(buffer.end(), { 'C', 'P', 'S', 'D' });
+  put(version);
+  put(n);
+  put(uvs.size());
+  put(mesh.triangles().size());
+  for (size_t i = 0; i < uvs.size(); ++i) {
+    for (const auto &sd : evaluation.sds[i]) {
+      putFloat(sd[0]);
+      putFloat(sd[1]);
+    }
+    putFloat(uvs[i][0]);
+    putFloat(uvs[i][1]);
+  }
+  for (const auto &t : mesh.triangles())
+    for (size_t i = 0; i < 3; ++i)
+      put(t[i]);
+  std::ofstream f(filename, std::ios::binary);
+  if (!f.is_open()) {
+    std::cerr << "Unable to open file: " << filename << std::endl;
+    return;
+  }
+  f.write(buffer.data(), buffer.size());
+  f.close();
+}
+
+// Formats of the parameter field output
+enum class DomainFormat { OBJ, BINARY, BOTH };
+
+// Writes the parameter fields as OBJ (basename.obj) and/or in binary (basename.bin)
+void
+domainEval(const std::shared_ptr<const DomainEvaluation> &evaluation, std::string basename,
+           DomainFormat format, OutputQueue &output) {
+  output.push(evaluationBytes(*evaluation), [evaluation, basename, format]() {
+                                              if (format != DomainFormat::BINARY)
+                                                writeDomainOBJ(*evaluation, basename + ".obj");
+                                              if (format != DomainFormat::OBJ)
+                                                writeDomainBinary(*evaluation, basename + ".bin");
+                                            });
+}
+
+void writeOBJ(const TriMesh &mesh, const VectorVector &normals, std::string filename) {
+  std::ofstream f(filename);
+  if (!f.is_open()) {
+    std::cerr << "Unable to open file: " << filename << std::endl;
+    return;
+  }
+  for (const auto &p : mesh.points())
+    f << "v " << p[0] << ' ' << p[1] << ' ' << p[2] << std::endl;
+  for (const auto &n : normals)
+    f << "vn " << n[0] << ' ' << n[1] << ' ' << n[2] << std::endl;
+  for (const auto &t : mesh.triangles()) {
+    f << 'f';
+    for (size_t i = 0; i < 3; ++i)
+      f << ' ' << t[i] + 1 << "//" << t[i] + 1;
+    f << std::endl;
+  }
+  f.close();
+}
+
+// Counts the vertex normals facing away from one of the triangles around them
+void normalCheck(const TriMesh &mesh, const VectorVector &normals, std::ostream &log) {
+  std::vector<bool> flipped(normals.size(), false);
+  for (const auto &t : mesh.triangles()) {
+    Vector3D face = (mesh[t[1]] - mesh[t[0]]) ^ (mesh[t[2]] - mesh[t[0]]);
+    if (face.norm() < epsilon)
+      continue;
+    for (size_t i = 0; i < 3; ++i)
+      if (normals[t[i]] * face < 0.0)
+        flipped[t[i]] = true;
+  }
+  size_t count = std::count(flipped.begin(), flipped.end(), true);
+  log << "  Normal check: " << count << " of " << normals.size()
+      << " vertex normals face away from an adjacent triangle" << std::endl;
+}
+
+// Options of surfaceTest: parameterization settings of the harmonic surfaces,
+// tessellation, projection, meshing and output; cheap to copy for the batch workers
+struct Settings {
+  size_t side_threads = 1;
+  double target_error = 0.0;    // automatic grid level when positive
+  Harmonic::Precision precision = Harmonic::Precision::DOUBLE;
+  bool precision_check = false; // compare against a double precision parameterization
+  Harmonic::Interpolation interpolation = Harmonic::Interpolation::BILINEAR;
+  double adaptive_tolerance = 0.0; // adaptive tessellation when positive
+  bool normals = false;         // write analytic normals for the curved surfaces
+  std::shared_ptr<const PointVector> projected; // points to project onto the curved surfaces
+  CurvedDomain::Mesher mesher = CurvedDomain::Mesher::TRIANGLE;
+  std::shared_ptr<OutputQueue> output; // background writer; files are written in place if null
+  DomainFormat domain_format = DomainFormat::OBJ; // of the parameter fields (CCB)
+  size_t memory_budget = 0;     // for each harmonic parameterization, in bytes (0: no limit);
+                                // batch workers each hold one, so the total is up to workers x this
+  BudgetPolicy budget_policy = BudgetPolicy::REFUSE;
+  double ribbon_tolerance = 0.0; // tabulated ribbons for the curved surfaces when positive
+  size_t progressive_level = 0; // first level of progressive evaluation when positive
+  bool lazy = false;            // solve the harmonic maps on first use
+  size_t fem_resolution = 0;    // finite element harmonic maps on this domain mesh when positive
+};
+
+void printMemory(const std::shared_ptr<Harmonic> &harmonic,
+                 const std::shared_ptr<CurvedDomain> &domain, std::ostream &log) {
+  MemoryUsage usage;
+  if (harmonic)
+    usage = harmonic->memoryUsage();
+  if (domain)
+    usage.meshes = domain->memoryUsage().meshes;
+  auto mb = [](size_t bytes) { return bytes / 1048576.0; };
+  log << "  Memory: " << mb(usage.total()) << "MB (grids: " << mb(usage.grids)
+      << "MB, meshes: " << mb(usage.meshes) << "MB, caches: " << mb(usage.caches)
+      << "MB, solver peak: " << mb(usage.solver) << "MB";
+  if (usage.spilled > 0)
+    log << ", spilled: " << mb(usage.spilled) << "MB";
+  log << ")" << std::endl;
+}
+
+PointVector readPoints(std::string filename) {
+  PointVector result;
+  std::ifstream f(filename);
+  Point3D p;
+  while (f >> p[0] >> p[1] >> p[2])
+    result.push_back(p);
+  return result;
+}
+
+void projectionTest(const std::shared_ptr<CurvedSurface> &surf, const PointVector &points,
+                    size_t resolution, size_t threads, std::string filename, std::ostream &log) {
   std::chrono::steady_clock::time_point begin, end;
+  begin = std::chrono::steady_clock::now();
+  Projection projection(surf, resolution);
+  auto uvs = projection.project(points, threads);
+  end = std::chrono::steady_clock::now();
+  log << "  Projection time (" << points.size() << " points): "
+      << std::chrono::duration_cast<std::chrono::milliseconds>(end - begin).count()
+      << "ms" << std::endl;
+
+  std::ofstream f(filename);
+  if (!f.is_open()) {
+    std::cerr << "Unable to open file: " << filename << std::endl;
+    return;
+  }
+  for (size_t i = 0; i < points.size(); ++i)
+    f << uvs[i][0] << ' ' << uvs[i][1] << ' ' << (surf->eval(uvs[i]) - points[i]).norm()
+      << std::endl;
+  f.close();
+}
+
+// Maximal and mean deviation of the (s, d) parameters from the double precision solution
+// (of the same parameterization type), evaluated at the vertices of the domain mesh.
+// The reference is refused when it does not fit in memory_budget (0: no limit).
+void precisionCheck(const std::shared_ptr<Surface> &surf, const std::shared_ptr<Harmonic> &harmonic,
+                    size_t resolution, size_t memory_budget, std::ostream &log) {
+  std::shared_ptr<Harmonic> reference;
+  if (std::dynamic_pointer_cast<ConstrainedHarmonic>(harmonic))
+    reference = std::make_shared<ConstrainedHarmonic>(harmonic->levels());
+  else
+    reference = std::make_shared<Harmonic>(harmonic->levels());
+  reference->setDomain(surf->domain());
+  reference->setInterpolation(harmonic->interpolation());
+  reference->setMemoryBudget(memory_budget, BudgetPolicy::REFUSE);
+  try {
+    reference->update();
+  } catch (const std::runtime_error &e) {
+    log << "  Precision check failed: " << e.what() << std::endl;
+    return;
+  }
+  const auto &uvs = surf->domain()->parameters(resolution);
+  size_t n = surf->domain()->size();
+  double max_s = 0.0, max_d = 0.0, sum_s = 0.0, sum_d = 0.0;
+  for (const auto &uv : uvs)
+    for (size_t i = 0; i < n; ++i) {
+      auto sd = harmonic->mapToRibbon(i, uv);
+      auto ref = reference->mapToRibbon(i, uv);
+      double ds = std::abs(sd[0] - ref[0]), dd = std::abs(sd[1] - ref[1]);
+      max_s = std::max(max_s, ds);
+      max_d = std::max(max_d, dd);
+      sum_s += ds;
+      sum_d += dd;
+    }
+  size_t count = std::max<size_t>(uvs.size() * n, 1);
+  log << "  Precision check: max |ds| = " << max_s << ", max |dd| = " << max_d
+      << ", mean |ds| = " << sum_s / count << ", mean |dd| = " << sum_d / count << std::endl;
+}
+
+// Returns false when the surface could not be set up (e.g. over the memory budget)
+bool surfaceTest(std::string name, std::shared_ptr<Surface> &&surf, const CurveVector &cv,
+                 std::string filename, size_t resolution, bool fix_mesh = false,
+                 const Settings &settings = Settings(), std::ostream &log = std::cout) {
+  log << name << ":" << std::endl;
+  std::chrono::steady_clock::time_point begin, end;
+
+  auto curved = std::dynamic_pointer_cast<CurvedSurface>(surf);
+  auto param = surf->parameterization();
+  if (curved && settings.fem_resolution > 0 && std::dynamic_pointer_cast<Harmonic>(param) &&
+      !std::dynamic_pointer_cast<ConstrainedHarmonic>(param))
+    curved->setParameterization(std::make_shared<FEMHarmonic>(settings.fem_resolution));
+  auto harmonic = std::dynamic_pointer_cast<Harmonic>(surf->parameterization());
+  if (harmonic) {
+    harmonic->setThreads(settings.side_threads);
+    harmonic->setAutoLevels(settings.target_error);
+    harmonic->setPrecision(settings.precision);
+    harmonic->setInterpolation(settings.interpolation);
+    harmonic->setGradients(settings.normals);
+    harmonic->setMemoryBudget(settings.memory_budget, settings.budget_policy);
+    harmonic->setLazy(settings.lazy);
+  }
+  if (curved)
+    curved->setRibbonTolerance(settings.ribbon_tolerance);
+  auto curved_domain = std::dynamic_pointer_cast<CurvedDomain>(surf->domain());
+  if (curved_domain)
+    curved_domain->setMesher(settings.mesher);
+  OutputQueue in_place(0);
+  auto &output = settings.output ? *settings.output : in_place;
+  // With a background writer, the output times only cover preparing and enqueueing the files
+  std::string queued = settings.output ? " (queued)" : "";
 
   begin = std::chrono::steady_clock::now();
   surf->setCurves(cv);
   surf->setupLoop();
-  surf->update();
+  try {
+    if (curved && harmonic && settings.progressive_level > 0) {
+      auto progress = [&](const TriMesh &mesh, size_t level) {
+                        auto now = std::chrono::steady_clock::now();
+                        auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(now - begin);
+                        log << "  Level " << level << " ready: " << ms.count() << "ms" << std::endl;
+                        std::stringstream level_file;
+                        level_file << filename << '-' << name << "-level" << level << ".obj";
+                        output.push(meshBytes(mesh), [mesh, file = level_file.str()]() {
+                                                       mesh.writeOBJ(file);
+                                                     });
+                      };
+      curved->updateProgressive(resolution, settings.progressive_level, progress);
+    } else
+      surf->update();
+  } catch (const std::runtime_error &e) {
+    log << "  Setup failed: " << e.what() << std::endl;
+    return false;
+  }
   end = std::chrono::steady_clock::now();
-  std::cout << "  Setup time: "
-            << std::chrono::duration_cast<std::chrono::milliseconds>(end - begin).count()
-            << "ms" << std::endl;
+  log << "  Setup time: "
+      << std::chrono::duration_cast<std::chrono::milliseconds>(end - begin).count()
+      << "ms" << std::endl;
+  if (harmonic && (settings.target_error > 0.0 || settings.memory_budget > 0))
+    log << "  Harmonic levels: " << harmonic->levels() << std::endl;
+  if (harmonic && settings.precision_check &&
+      settings.precision != Harmonic::Precision::DOUBLE)
+    precisionCheck(surf, harmonic, resolution, settings.memory_budget, log);
 
+  std::shared_ptr<const DomainEvaluation> evaluation; // shared by the domain and mesh outputs
+  // The final mesh is taken from the evaluation, unless it is adaptive or has normals
+  bool reuse = settings.adaptive_tolerance <= 0.0 && !(settings.normals && curved);
+  std::chrono::steady_clock::duration evaluation_time(0);
   if (name == "CCB") {
     begin = std::chrono::steady_clock::now();
-    ribbonTest(surf, resolution, filename + "-ribbons.obj");
+    ribbonTest(surf, resolution, filename + "-ribbons.obj", output);
     end = std::chrono::steady_clock::now();
-    std::cout << "  Ribbon output time: "
-              << std::chrono::duration_cast<std::chrono::milliseconds>(end - begin).count()
-              << "ms" << std::endl;
+    log << "  Ribbon output time" << queued << ": "
+        << std::chrono::duration_cast<std::chrono::milliseconds>(end - begin).count()
+        << "ms" << std::endl;
 
     begin = std::chrono::steady_clock::now();
-    domainEval(surf, resolution, filename + "-domain.obj");
-    domainEval3D(surf, resolution, filename + "-domain3D.obj");
+    evaluation = evalDomain(surf, resolution);
     end = std::chrono::steady_clock::now();
-    std::cout << "  Domain output time: "
-              << std::chrono::duration_cast<std::chrono::milliseconds>(end - begin).count()
-              << "ms" << std::endl;
+    evaluation_time = end - begin;
+    if (!reuse)
+      log << "  Domain evaluation time: "
+          << std::chrono::duration_cast<std::chrono::milliseconds>(evaluation_time).count()
+          << "ms" << std::endl;
+
+    begin = std::chrono::steady_clock::now();
+    domainEval(evaluation, filename + "-domain", settings.domain_format, output);
+    domainEval3D(evaluation, filename + "-domain3D.obj", output);
+    end = std::chrono::steady_clock::now();
+    log << "  Domain output time" << queued << ": "
+        << std::chrono::duration_cast<std::chrono::milliseconds>(end - begin).count()
+        << "ms" << std::endl;
   }
   
   begin = std::chrono::steady_clock::now();
-  auto mesh = surf->eval(resolution);
+  VectorVector normals;
+  TriMesh mesh;
+  if (settings.adaptive_tolerance > 0.0) {
+    Point2DVector uvs;
+    mesh = AdaptiveMesh::eval(*surf, resolution, settings.adaptive_tolerance, uvs);
+    if (settings.normals && curved)
+      std::transform(uvs.begin(), uvs.end(), std::back_inserter(normals),
+                     [&](const Point2D &uv) { return curved->normal(uv); });
+  } else if (settings.normals && curved)
+    mesh = curved->eval(resolution, normals);
+  else if (evaluation)
+    mesh = evaluation->mesh;
+  else
+    mesh = surf->eval(resolution);
   end = std::chrono::steady_clock::now();
-  std::cout << "  Evaluation time: "
-            << std::chrono::duration_cast<std::chrono::milliseconds>(end - begin).count()
-            << "ms" << std::endl;
+  auto mesh_time = end - begin;
+  if (evaluation && reuse)
+    mesh_time += evaluation_time; // the mesh was evaluated with the domain outputs
+  log << "  Evaluation time: "
+      << std::chrono::duration_cast<std::chrono::milliseconds>(mesh_time).count()
+      << "ms" << std::endl;
+  if (settings.adaptive_tolerance > 0.0)
+    log << "  Adaptive mesh: " << mesh.triangles().size() << " triangles" << std::endl;
+  if (harmonic || curved_domain)
+    printMemory(harmonic, curved_domain, log);
 
   if (fix_mesh)
     fixMesh(mesh, cv, resolution); // computes exact boundaries
-  mesh.writeOBJ(filename + "-" + name + ".obj");
+  if (!normals.empty())
+    normalCheck(mesh, normals, log);
+  std::string mesh_file = filename + "-" + name + ".obj";
+  size_t bytes = meshBytes(mesh) + normals.size() * sizeof(Vector3D);
+  output.push(bytes, [mesh = std::move(mesh), normals = std::move(normals), mesh_file]() {
+                       if (!normals.empty())
+                         writeOBJ(mesh, normals, mesh_file);
+                       else
+                         mesh.writeOBJ(mesh_file);
+                     });
+
+  if (curved && settings.projected)
+    projectionTest(curved, *settings.projected, resolution, settings.side_threads,
+                   filename + "-" + name + "-projection.txt", log);
+  return true;
+}
+
+struct SurfaceType {
+  std::string name;
+  std::function<std::shared_ptr<Surface>()> create;
+  bool fix_mesh;
+};
+
+const std::vector<SurfaceType> surface_types = {
+  { "CGC", []() { return std::make_shared<CurvedGC>(); }, true },
+  { "CCB", []() { return std::make_shared<CurvedCB>(); }, true },
+  { "CCR", []() { return std::make_shared<CurvedCR>(); }, false },
+  { "GC", []() { return std::make_shared<Transfinite::SurfaceGeneralizedCoons>(); }, false },
+  { "CB", []() { return std::make_shared<Transfinite::SurfaceCornerBased>(); }, false },
+  { "PCB", []() { return std::make_shared<PerpCB>(); }, false }
+};
+
+// Parses a comma-separated list of surface type names; returns false on unknown names.
+bool parseTypes(std::string list, std::vector<SurfaceType> &types) {
+  types.clear();
+  std::stringstream ss(list);
+  std::string name;
+  while (std::getline(ss, name, ',')) {
+    auto it = std::find_if(surface_types.begin(), surface_types.end(),
+                           [&](const SurfaceType &t) { return t.name == name; });
+    if (it == surface_types.end())
+      return false;
+    types.push_back(*it);
+  }
+  return !types.empty();
+}
+
+// Basenames of all .lop files in a directory, or the lines of a list file.
+std::vector<std::string> batchFiles(std::string path) {
+  std::vector<std::string> result;
+  auto strip = [](std::string name) {
+                 if (name.size() > 4 && name.substr(name.size() - 4) == ".lop")
+                   name.resize(name.size() - 4);
+                 return name;
+               };
+  if (std::filesystem::is_directory(path)) {
+    for (const auto &entry : std::filesystem::directory_iterator(path))
+      if (entry.path().extension() == ".lop")
+        result.push_back(strip(entry.path().string()));
+    std::sort(result.begin(), result.end());
+  } else {
+    std::ifstream f(path);
+    std::string line;
+    while (std::getline(f, line))
+      if (!line.empty() && line[0] != '#')
+        result.push_back(strip(line));
+  }
+  return result;
+}
+
+// Processes the patches on a pool of `threads` workers.
+// When there are fewer patches than threads, the remaining cores solve the sides in parallel.
+int batchTest(const std::vector<std::string> &files, const std::vector<SurfaceType> &types,
+              size_t resolution, size_t threads, Settings settings) {
+  size_t workers = std::max<size_t>(std::min(threads, files.size()), 1);
+  settings.side_threads = std::max<size_t>(threads / workers, 1);
+  std::atomic<size_t> next_file(0), failed(0);
+  std::mutex output;
+
+  auto begin = std::chrono::steady_clock::now();
+  std::vector<std::thread> pool;
+  for (size_t t = 0; t < workers; ++t)
+    pool.emplace_back([&]() {
+                        for (size_t i = next_file++; i < files.size(); i = next_file++) {
+                          std::stringstream log;
+                          log << files[i] << std::endl;
+                          CurveVector cv = readLOP(files[i] + ".lop");
+                          if (cv.empty()) {
+                            log << "  Cannot read file" << std::endl;
+                            ++failed;
+                          } else {
+                            bool ok = true;
+                            for (const auto &type : types)
+                              ok &= surfaceTest(type.name, type.create(), cv, files[i], resolution,
+                                                type.fix_mesh, settings, log);
+                            if (!ok)
+                              ++failed;
+                          }
+                          std::lock_guard<std::mutex> lock(output);
+                          std::cout << log.str();
+                        }
+                      });
+  for (auto &t : pool)
+    t.join();
+  if (settings.output)
+    settings.output->wait();
+  auto end = std::chrono::steady_clock::now();
+
+  double seconds = std::chrono::duration<double>(end - begin).count();
+  size_t done = files.size() - failed;
+  std::cout << "Batch summary:" << std::endl
+            << "  Patches: " << done << " processed, " << failed << " failed" << std::endl
+            << "  Threads: " << workers << " workers x " << settings.side_threads << " side threads"
+            << std::endl
+            << "  Wall time: " << seconds << "s" << std::endl
+            << "  Throughput: " << done / seconds << " patches/s, "
+            << done * types.size() / seconds << " surfaces/s" << std::endl;
+  return failed > 0 ? 2 : 0;
+}
+
+void usage(const char *program) {
+  std::cerr << "Usage: " << program << " basename [resolution]" << std::endl
+            << "       " << program
+            << " --batch <list-file|directory> [resolution]" << std::endl
+            << "Options: --types CCB,PCB,...  surface types (CGC, CCB, CCR, GC, CB, PCB)"
+            << std::endl
+            << "         --threads N          number of worker threads" << std::endl
+            << "         --auto-level E       choose harmonic grid levels for target error E"
+            << std::endl
+            << "         --precision P        harmonic map precision (double, single-storage, single)"
+            << std::endl
+            << "         --precision-check    compare single precision maps with double precision"
+            << std::endl
+            << "         --interpolation I    harmonic map interpolation (bilinear, bicubic)"
+            << std::endl
+            << "         --adaptive T         refine the mesh of the given resolution to tolerance T"
+            << std::endl
+            << "         --normals            write analytic vertex normals (curved surfaces)"
+            << std::endl
+            << "         --project FILE       project the points in FILE onto the curved surfaces"
+            << std::endl
+            << "         --mesher M           curved domain mesher (triangle, grid)" << std::endl
+            << "         --domain-format F    parameter field output (obj, bin, both; default: obj)"
+            << std::endl
+            << "         --output-buffer MB   memory for the background file writer"
+            << " (default: 256, 0: write in place)" << std::endl
+            << "         --memory-budget MB   memory limit for each harmonic parameterization"
+            << " (per surface;" << std::endl
+            << "                              in batch mode up to threads x MB in total)"
+            << std::endl
+            << "         --budget-policy P    over the budget: refuse, downgrade, spill"
+            << " (default: refuse)" << std::endl
+            << "         --ribbon-table T     tabulate the ribbons of the curved surfaces"
+            << " with error bound T" << std::endl
+            << "         --progressive L      also evaluate the harmonic surfaces from level L up"
+            << std::endl
+            << "         --lazy               solve the harmonic maps of the sides on first use"
+            << std::endl
+            << "         --fem R              finite element harmonic maps on the domain mesh"
+            << " of resolution R (CCB, CCR)" << std::endl;
 }
 
 int main(int argc, char **argv) {
-  if (argc < 2 || argc > 3) {
-    std::cerr << "Usage: " << argv[0]
-              << " basename [resolution]" << std::endl;
+  std::vector<std::string> args;
+  std::string batch, types_list = "CCB,PCB";
+  size_t threads = std::max(std::thread::hardware_concurrency(), 1u);
+  Settings settings;
+  size_t output_buffer = 256;   // MB
+  const std::vector<std::string> with_value = {
+    "--batch", "--types", "--threads", "--auto-level", "--precision", "--interpolation",
+    "--adaptive", "--project", "--mesher", "--domain-format", "--output-buffer",
+    "--memory-budget", "--budget-policy", "--ribbon-table", "--progressive",
+    "--fem"
+  };
+  for (int i = 1; i < argc; ++i) {
+    std::string arg(argv[i]);
+    if (std::find(with_value.begin(), with_value.end(), arg) != with_value.end() && i + 1 == argc) {
+      usage(argv[0]);
+      return 1;
+    }
+    if (arg == "--batch")
+      batch = argv[++i];
+    else if (arg == "--types")
+      types_list = argv[++i];
+    else if (arg == "--threads")
+      threads = std::max(std::atoi(argv[++i]), 1);
+    else if (arg == "--auto-level")
+      settings.target_error = std::atof(argv[++i]);
+    else if (arg == "--precision") {
+      std::string precision(argv[++i]);
+      if (precision == "double")
+        settings.precision = Harmonic::Precision::DOUBLE;
+      else if (precision == "single-storage")
+        settings.precision = Harmonic::Precision::SINGLE_STORAGE;
+      else if (precision == "single")
+        settings.precision = Harmonic::Precision::SINGLE;
+      else {
+        usage(argv[0]);
+        return 1;
+      }
+    } else if (arg == "--precision-check")
+      settings.precision_check = true;
+    else if (arg == "--interpolation") {
+      std::string interpolation(argv[++i]);
+      if (interpolation == "bilinear")
+        settings.interpolation = Harmonic::Interpolation::BILINEAR;
+      else if (interpolation == "bicubic")
+        settings.interpolation = Harmonic::Interpolation::BICUBIC;
+      else {
+        usage(argv[0]);
+        return 1;
+      }
+    } else if (arg == "--adaptive")
+      settings.adaptive_tolerance = std::atof(argv[++i]);
+    else if (arg == "--normals")
+      settings.normals = true;
+    else if (arg == "--mesher") {
+      std::string mesher(argv[++i]);
+      if (mesher == "triangle")
+        settings.mesher = CurvedDomain::Mesher::TRIANGLE;
+      else if (mesher == "grid")
+        settings.mesher = CurvedDomain::Mesher::GRID;
+      else {
+        usage(argv[0]);
+        return 1;
+      }
+    } else if (arg == "--domain-format") {
+      std::string format(argv[++i]);
+      if (format == "obj")
+        settings.domain_format = DomainFormat::OBJ;
+      else if (format == "bin")
+        settings.domain_format = DomainFormat::BINARY;
+      else if (format == "both")
+        settings.domain_format = DomainFormat::BOTH;
+      else {
+        usage(argv[0]);
+        return 1;
+      }
+    } else if (arg == "--output-buffer")
+      output_buffer = std::max(std::atoi(argv[++i]), 0);
+    else if (arg == "--memory-budget")
+      settings.memory_budget = (size_t)std::max(std::atoi(argv[++i]), 0) << 20;
+    else if (arg == "--budget-policy") {
+      std::string policy(argv[++i]);
+      if (policy == "refuse")
+        settings.budget_policy = BudgetPolicy::REFUSE;
+      else if (policy == "downgrade")
+        settings.budget_policy = BudgetPolicy::DOWNGRADE;
+      else if (policy == "spill")
+        settings.budget_policy = BudgetPolicy::SPILL;
+      else {
+        usage(argv[0]);
+        return 1;
+      }
+    } else if (arg == "--ribbon-table")
+      settings.ribbon_tolerance = std::atof(argv[++i]);
+    else if (arg == "--lazy")
+      settings.lazy = true;
+    else if (arg == "--progressive")
+      settings.progressive_level = std::max(std::atoi(argv[++i]), 0);
+    else if (arg == "--fem")
+      settings.fem_resolution = std::max(std::atoi(argv[++i]), 0);
+    else if (arg == "--project") {
+      auto points = readPoints(argv[++i]);
+      if (points.empty()) {
+        std::cerr << "Cannot read points: " << argv[i] << std::endl;
+        return 2;
+      }
+      settings.projected = std::make_shared<const PointVector>(std::move(points));
+    }
+    else
+      args.push_back(arg);
+  }
+
+  if (output_buffer > 0)
+    settings.output = std::make_shared<OutputQueue>(output_buffer << 20);
+
+  std::vector<SurfaceType> types;
+  if (!parseTypes(types_list, types)) {
+    std::cerr << "Unknown surface type in: " << types_list << std::endl;
     return 1;
   }
-  std::string fname(argv[1]);
+
+  if (!batch.empty()) {
+    if (args.size() > 1) {
+      usage(argv[0]);
+      return 1;
+    }
+    size_t resolution = 30;
+    if (args.size() == 1)
+      resolution = std::atoi(args[0].c_str());
+    auto files = batchFiles(batch);
+    if (files.empty()) {
+      std::cerr << "No patches found in: " << batch << std::endl;
+      return 2;
+    }
+    return batchTest(files, types, resolution, threads, settings);
+  }
+
+  if (args.empty() || args.size() > 2) {
+    usage(argv[0]);
+    return 1;
+  }
+  std::string fname(args[0]);
 
   CurveVector cv = readLOP(fname + ".lop");
   if (cv.empty()) {
-    std::cerr << "Cannot read file: " << argv[1] << std::endl;
+    std::cerr << "Cannot read file: " << fname << std::endl;
     return 2;
   }
   
   size_t resolution = 30;
-  if (argc == 3)
-    resolution = std::atoi(argv[2]);
-
-  // surfaceTest("CGC", std::make_shared<CurvedGC>(), cv, fname, resolution, true);
-  surfaceTest("CCB", std::make_shared<CurvedCB>(), cv, fname, resolution, true);
-  // surfaceTest("CCR", std::make_shared<CurvedCR>(), cv, fname, resolution, false);
-  // surfaceTest("GC", std::make_shared<Transfinite::SurfaceGeneralizedCoons>(),
-  //             cv, fname, resolution);
-  // surfaceTest("CB", std::make_shared<Transfinite::SurfaceCornerBased>(),
-  //             cv, fname, resolution);
-  surfaceTest("PCB", std::make_shared<PerpCB>(), cv, fname, resolution);
-
-  return 0;
+  if (args.size() == 2)
+    resolution = std::atoi(args[1].c_str());
+
+  settings.side_threads = threads;
+  bool ok = true;
+  for (const auto &type : types)
+    ok &= surfaceTest(type.name, type.create(), cv, fname, resolution, type.fix_mesh, settings);
+
+  return ok ? 0 : 2;
 }
@@ -0,0 +1,203 @@
+#include "curved-surface.hh"
+
+#include <algorithm>
+
+#include <ribbon-perpendicular.hh>
+
+#include "differentiable-parameterization.hh"
+#include "harmonic.hh"
+#include "tabulated-ribbon.hh"
+
+using RibbonType = Transfinite::RibbonPerpendicular;
+
+namespace {
+
+  // The domain meshes are clockwise in (u, v), so the faces of the surface meshes
+  // point along dv x du
+  Vector3D unitNormal(const Vector3D &du, const Vector3D &dv) {
+    Vector3D n = dv ^ du;
+    if (n.norm() > epsilon)
+      n.normalize();
+    return n;
+  }
+
+}
+
+CurvedSurface::CurvedSurface() : ribbon_tolerance_(0.0) {
+}
+
+CurvedSurface::~CurvedSurface() {
+}
+
+Point3D
+CurvedSurface::eval(const Point2D &uv) const {
+  return eval(param_->mapToRibbons(uv));
+}
+
+Point3D
+CurvedSurface::eval(const Point2DVector &sds) const {
+  DoubleVector blends = blendCorner(sds);
+  PointVector terms = cornerTerms(sds);
+  Point3D p(0,0,0);
+  for (size_t i = 0; i < n_; ++i)
+    p += terms[i] * blends[i];
+  return p;
+}
+
+Point3D
+CurvedSurface::eval(const Point2D &uv, Vector3D &du, Vector3D &dv) const {
+  // The parameters and the blends are differentiated analytically, the interpolants
+  // (ribbons and corner corrections of the Transfinite library, which has no derivatives
+  // for them) by central differences along the parameter derivatives.
+  // This costs one parameterization pass and 5 evaluations of the corner terms.
+  const double h = 1.0e-5;
+  std::vector<Vector2DVector> der;
+  Point2DVector sds = mapToRibbons(uv, der);
+  DoubleVector blends = blendCorner(sds);
+  Vector2DVector dblends = blendCornerDerivatives(sds, der, blends);
+  auto shifted = [&](size_t k, double step) {
+                   Point2DVector result; result.reserve(n_);
+                   for (size_t i = 0; i < n_; ++i)
+                     result.push_back(sds[i] + der[i][k] * step);
+                   return cornerTerms(result);
+                 };
+  PointVector terms = cornerTerms(sds);
+  PointVector terms_u0 = shifted(0, -h), terms_u1 = shifted(0, h);
+  PointVector terms_v0 = shifted(1, -h), terms_v1 = shifted(1, h);
+  Point3D p(0,0,0);
+  du = Vector3D(0,0,0);
+  dv = Vector3D(0,0,0);
+  for (size_t i = 0; i < n_; ++i) {
+    p += terms[i] * blends[i];
+    du += terms[i] * dblends[i][0] + (terms_u1[i] - terms_u0[i]) * (blends[i] / (2.0 * h));
+    dv += terms[i] * dblends[i][1] + (terms_v1[i] - terms_v0[i]) * (blends[i] / (2.0 * h));
+  }
+  return p;
+}
+
+Vector3D
+CurvedSurface::normal(const Point2D &uv) const {
+  Vector3D du, dv;
+  eval(uv, du, dv);
+  return unitNormal(du, dv);
+}
+
+TriMesh
+CurvedSurface::eval(size_t resolution, VectorVector &normals) const {
+  TriMesh mesh = domain_->meshTopology(resolution);
+  const Point2DVector &uvs = domain_->parameters(resolution);
+  PointVector points; points.reserve(uvs.size());
+  normals.clear(); normals.reserve(uvs.size());
+  for (const auto &uv : uvs) {
+    Vector3D du, dv;
+    points.push_back(eval(uv, du, dv));
+    normals.push_back(unitNormal(du, dv));
+  }
+  mesh.setPoints(points);
+  return mesh;
+}
+
+void
+CurvedSurface::setRibbonTolerance(double tolerance) {
+  ribbon_tolerance_ = tolerance;
+}
+
+void
+CurvedSurface::setParameterization(const std::shared_ptr<Parameterization> &param) {
+  param_ = param;
+  param_->setDomain(domain_);
+}
+
+void
+CurvedSurface::updateProgressive(size_t resolution, size_t first_level,
+                                 const std::function<void(const TriMesh &, size_t)> &callback) {
+  auto harmonic = std::dynamic_pointer_cast<Harmonic>(param_);
+  if (!harmonic) {
+    update();
+    return;
+  }
+  // As in Surface::update(), but the ribbons are updated before the parameterization,
+  // so that the previews show the final ribbons
+  bool changed = domain_->update();
+  for (size_t i = 0; i < n_; ++i)
+    ribbon(i)->update();
+  if (!changed)
+    return;
+  // One coarse domain mesh for all levels, so the domain is triangulated only once
+  const size_t min_resolution = 4;
+  size_t coarse = std::max(resolution / 2, min_resolution);
+  TriMesh mesh = domain_->meshTopology(coarse);
+  const Point2DVector uvs = domain_->parameters(coarse);
+  harmonic->setProgress(first_level, [&](size_t level) {
+                                       PointVector points; points.reserve(uvs.size());
+                                       for (const auto &uv : uvs)
+                                         points.push_back(eval(uv));
+                                       mesh.setPoints(points);
+                                       callback(mesh, level);
+                                     });
+  try {
+    harmonic->update();
+  } catch (...) {
+    harmonic->setProgress(0, nullptr);
+    throw;
+  }
+  harmonic->setProgress(0, nullptr);
+}
+
+std::shared_ptr<Ribbon>
+CurvedSurface::newRibbon() const {
+  if (ribbon_tolerance_ > 0.0)
+    return std::make_shared<TabulatedRibbon>(ribbon_tolerance_);
+  return std::make_shared<RibbonType>();
+}
+
+Point2DVector
+CurvedSurface::mapToRibbons(const Point2D &uv, std::vector<Vector2DVector> &der) const {
+  der.resize(n_);
+  if (auto param = dynamic_cast<const DifferentiableParameterization *>(param_.get())) {
+    Point2DVector sds; sds.reserve(n_);
+    for (size_t i = 0; i < n_; ++i)
+      sds.push_back(param->mapToRibbonDerivatives(i, uv, der[i]));
+    return sds;
+  }
+  // Central differences for other parameterizations
+  const double h = 1.0e-5;
+  Point2DVector sds = param_->mapToRibbons(uv);
+  Point2DVector su0 = param_->mapToRibbons(uv - Vector2D(h, 0));
+  Point2DVector su1 = param_->mapToRibbons(uv + Vector2D(h, 0));
+  Point2DVector sv0 = param_->mapToRibbons(uv - Vector2D(0, h));
+  Point2DVector sv1 = param_->mapToRibbons(uv + Vector2D(0, h));
+  for (size_t i = 0; i < n_; ++i)
+    der[i] = { (su1[i] - su0[i]) / (2.0 * h), (sv1[i] - sv0[i]) / (2.0 * h) };
+  return sds;
+}
+
+Vector2DVector
+CurvedSurface::blendCornerDerivatives(const Point2DVector &sds,
+                                      const std::vector<Vector2DVector> &der,
+                                      const DoubleVector &blends) const {
+  // B_i = w_i / sum_j w_j, where w_i = (d_i d_{i+1})^-2; multiplied by prod_k d_k^2,
+  // w_i = prod_{k != i, i+1} d_k^2, which is polynomial, so this also holds on the boundary
+  // (where Surface::blendCorner takes the limit of the blends)
+  auto product = [&](size_t i, size_t skip) {
+                   double result = 1.0;
+                   for (size_t k = 0; k < n_; ++k)
+                     if (k != i && k != next(i) && k != skip)
+                       result *= sds[k][1] * sds[k][1];
+                   return result;
+                 };
+  Vector2DVector dw(n_, Vector2D(0, 0));
+  Vector2D dsum(0, 0);
+  double sum = 0.0;
+  for (size_t i = 0; i < n_; ++i) {
+    sum += product(i, n_);
+    for (size_t k = 0; k < n_; ++k)
+      if (k != i && k != next(i))
+        dw[i] += Vector2D(der[k][0][1], der[k][1][1]) * (2.0 * sds[k][1] * product(i, k));
+    dsum += dw[i];
+  }
+  Vector2DVector result; result.reserve(n_);
+  for (size_t i = 0; i < n_; ++i)
+    result.push_back((dw[i] - dsum * blends[i]) / sum);
+  return result;
+}
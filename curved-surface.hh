@@ -0,0 +1,58 @@
+#pragma once
+
+#include <functional>
+
+#include <surface.hh>
+
+using namespace Geometry;
+using Transfinite::Parameterization;
+using Transfinite::Ribbon;
+using Transfinite::Surface;
+
+// Base of the curved surfaces, which are all of the form sum_i T_i * B_i,
+// where B_i are the corner blends. This makes it possible to evaluate the derivatives
+// with a single parameterization and blending pass.
+class CurvedSurface : public Surface {
+public:
+  CurvedSurface();
+  CurvedSurface(const CurvedSurface &) = default;
+  virtual ~CurvedSurface();
+  CurvedSurface &operator=(const CurvedSurface &) = default;
+  virtual Point3D eval(const Point2D &uv) const override;
+  // At the ribbon parameters of a domain point (as given by mapToRibbons)
+  Point3D eval(const Point2DVector &sds) const;
+  // Also computes the derivatives by u and v; the parameterization and the blends
+  // are differentiated analytically, the corner terms by central differences,
+  // so this costs 4 more evaluations of the corner terms than eval(uv)
+  Point3D eval(const Point2D &uv, Vector3D &du, Vector3D &dv) const;
+  Vector3D normal(const Point2D &uv) const;
+  TriMesh eval(size_t resolution, VectorVector &normals) const;
+  using Surface::eval;
+  // Tabulate the ribbons with this error bound (0: exact evaluation);
+  // affects the ribbons created afterwards, so it should precede setCurves()
+  void setRibbonTolerance(double tolerance);
+  // Replaces the parameterization (on the same domain); takes effect in the next update()
+  void setParameterization(const std::shared_ptr<Parameterization> &param);
+  // Progressive update: while a harmonic parameterization is solved level by level,
+  // callback(mesh, level) receives the surface evaluated on each level from first_level,
+  // on one domain mesh of half the resolution. The domain and the ribbons are updated
+  // first, then the parameterization. The callback runs synchronously in the solve,
+  // which waits for it before the next level, so it should only hand the mesh on
+  // (e.g. to an output queue). When this returns, the surface is up to date
+  // as after update().
+  void updateProgressive(size_t resolution, size_t first_level,
+                         const std::function<void(const TriMesh &, size_t)> &callback);
+
+protected:
+  virtual std::shared_ptr<Ribbon> newRibbon() const override;
+  // The terms T_i multiplying the corner blends
+  virtual PointVector cornerTerms(const Point2DVector &sds) const = 0;
+
+private:
+  Point2DVector mapToRibbons(const Point2D &uv, std::vector<Vector2DVector> &der) const;
+  Vector2DVector blendCornerDerivatives(const Point2DVector &sds,
+                                        const std::vector<Vector2DVector> &der,
+                                        const DoubleVector &blends) const;
+
+  double ribbon_tolerance_;
+};
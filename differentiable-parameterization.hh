@@ -0,0 +1,15 @@
+#pragma once
+
+#include <geometry.hh>
+
+using namespace Geometry;
+
+// Parameterizations that also give the derivatives of the ribbon parameters,
+// used by CurvedSurface for the analytic surface derivatives
+class DifferentiableParameterization {
+public:
+  virtual ~DifferentiableParameterization() = default;
+  // (s, d) with its derivatives by u (der[0]) and by v (der[1])
+  virtual Point2D mapToRibbonDerivatives(size_t i, const Point2D &uv,
+                                         Vector2DVector &der) const = 0;
+};
@@ -0,0 +1,326 @@
+#include "fem-harmonic.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <map>
+#include <stdexcept>
+
+#include <Eigen/SparseCholesky>
+
+#include "curved-domain.hh"
+
+FEMHarmonic::FEMHarmonic(size_t resolution) : resolution_(resolution), generation_(0) {
+}
+
+FEMHarmonic::~FEMHarmonic() {
+}
+
+namespace {
+
+  inline double cross(const Vector2D &a, const Vector2D &b) {
+    return a[0] * b[1] - a[1] * b[0];
+  }
+
+  std::array<double, 3> barycentric(const Point2D &a, const Point2D &b, const Point2D &c,
+                                    const Point2D &p) {
+    double area = cross(b - a, c - a);
+    double la = cross(b - p, c - p) / area, lb = cross(c - p, a - p) / area;
+    return { la, lb, 1.0 - la - lb };
+  }
+
+  Point2D closestOnSegment(const Point2D &p, const Point2D &a, const Point2D &b) {
+    Vector2D ab = b - a;
+    double t = std::clamp((p - a) * ab / std::max(ab * ab, epsilon), 0.0, 1.0);
+    return a + ab * t;
+  }
+
+  // Each update gets a unique generation, so cached locations of old meshes are not reused
+  std::atomic<size_t> generations(0);
+
+}
+
+void
+FEMHarmonic::update() {
+  auto domain = dynamic_cast<CurvedDomain *>(domain_.get());
+  if (!domain)
+    throw std::runtime_error("FEMHarmonic: the domain is not a CurvedDomain");
+  n_ = domain->boundaries().size();
+  points_ = domain->parameters(resolution_);
+  triangles_.clear();
+  for (const auto &t : domain->meshTopology(resolution_).triangles())
+    triangles_.push_back({ t[0], t[1], t[2] });
+  size_t nv = points_.size(), nb = n_ * resolution_;
+
+  // Boundary loop: edges with a single triangle
+  std::map<std::pair<size_t, size_t>, size_t> edge_count;
+  for (const auto &t : triangles_)
+    for (size_t k = 0; k < 3; ++k) {
+      size_t a = t[k], b = t[(k+1)%3];
+      edge_count[{ std::min(a, b), std::max(a, b) }]++;
+    }
+  std::vector<std::vector<size_t>> neighbors(nv);
+  for (const auto &[edge, count] : edge_count)
+    if (count == 1) {
+      neighbors[edge.first].push_back(edge.second);
+      neighbors[edge.second].push_back(edge.first);
+    }
+  std::vector<size_t> loop = { 0 };
+  for (size_t prev = 0, v = 0; ; ) {
+    if (neighbors[v].size() != 2 || loop.size() > nv)
+      throw std::runtime_error("FEMHarmonic: the domain boundary is not a simple loop");
+    size_t next = neighbors[v][0] == prev && loop.size() > 1 ? neighbors[v][1] : neighbors[v][0];
+    prev = v;
+    v = next;
+    if (v == 0)
+      break;
+    loop.push_back(v);
+  }
+  // Go in the direction of the boundary samples
+  auto second = std::find_if(loop.begin() + 1, loop.end(), [&](size_t v) { return v < nb; });
+  if (second != loop.end() && *second != 1)
+    std::reverse(loop.begin() + 1, loop.end());
+
+  // Boundary values by curve and parameter; the samples (the first nb vertices) are exact,
+  // points inserted between them are interpolated by chord length
+  const size_t none = std::numeric_limits<size_t>::max();
+  std::vector<size_t> curve(nv, none);
+  DoubleVector param(nv, 0.0);
+  for (size_t k = 0; k < loop.size(); ) {
+    size_t a = loop[k], l = k + 1;
+    while (l < loop.size() && loop[l] >= nb)
+      ++l;
+    size_t b = l < loop.size() ? loop[l] : loop[0];
+    if (a >= nb || b >= nb)
+      throw std::runtime_error("FEMHarmonic: unexpected boundary vertex order");
+    size_t j = a / resolution_;
+    double ua = (double)(a % resolution_) / resolution_;
+    double ub = b / resolution_ == j ? (double)(b % resolution_) / resolution_ : 1.0;
+    curve[a] = j;
+    param[a] = ua;
+    double length = 0.0, total = 0.0;
+    for (size_t m = k; m < l; ++m)
+      total += (points_[m + 1 < loop.size() ? loop[m+1] : loop[0]] - points_[loop[m]]).norm();
+    for (size_t m = k + 1; m < l; ++m) {
+      length += (points_[loop[m]] - points_[loop[m-1]]).norm();
+      curve[loop[m]] = j;
+      param[loop[m]] = ua + (ub - ua) * length / std::max(total, epsilon);
+    }
+    k = l;
+  }
+
+  // Cotangent stiffness matrix, split into interior-interior and interior-boundary parts
+  std::vector<size_t> index(nv, none);
+  size_t ni = 0;
+  for (size_t v = 0; v < nv; ++v)
+    if (curve[v] == none)
+      index[v] = ni++;
+  Eigen::MatrixXd boundary_values(nv, n_);
+  for (size_t v = 0; v < nv; ++v)
+    for (size_t i = 0; i < n_; ++i) {
+      double value = 0.0;
+      if (curve[v] == i)
+        value = param[v];
+      else if (curve[v] == next(i))
+        value = 1.0 - param[v];
+      boundary_values(v, i) = value;
+    }
+  std::vector<Eigen::Triplet<double>> triplets;
+  Eigen::MatrixXd rhs = Eigen::MatrixXd::Zero(ni, n_);
+  auto add = [&](size_t a, size_t b, double w) {
+               if (index[a] == none)
+                 return;
+               triplets.emplace_back(index[a], index[a], w);
+               if (index[b] != none)
+                 triplets.emplace_back(index[a], index[b], -w);
+               else
+                 rhs.row(index[a]) += boundary_values.row(b) * w;
+             };
+  for (const auto &t : triangles_)
+    for (size_t k = 0; k < 3; ++k) {
+      size_t a = t[k], b = t[(k+1)%3], c = t[(k+2)%3];
+      Vector2D u = points_[a] - points_[c], v = points_[b] - points_[c];
+      double w = 0.5 * (u * v) / std::max(std::abs(cross(u, v)), epsilon); // cot at c / 2
+      add(a, b, w);
+      add(b, a, w);
+    }
+  Eigen::SparseMatrix<double> stiffness(ni, ni);
+  stiffness.setFromTriplets(triplets.begin(), triplets.end());
+  Eigen::SimplicialLDLT<Eigen::SparseMatrix<double>> solver(stiffness);
+  if (solver.info() != Eigen::Success)
+    throw std::runtime_error("FEMHarmonic: cannot factorize the stiffness matrix");
+  Eigen::MatrixXd x = solver.solve(rhs);
+
+  values_.resize(nv * n_);
+  for (size_t v = 0; v < nv; ++v)
+    for (size_t i = 0; i < n_; ++i)
+      values_[v*n_+i] = index[v] == none ? boundary_values(v, i) : x(index[v], i);
+
+  buildBuckets();
+  generation_ = ++generations;
+}
+
+void
+FEMHarmonic::buildBuckets() {
+  min_ = points_[0];
+  Point2D max = points_[0];
+  for (const auto &p : points_)
+    for (size_t k = 0; k < 2; ++k) {
+      min_[k] = std::min(min_[k], p[k]);
+      max[k] = std::max(max[k], p[k]);
+    }
+  cells_ = std::max<size_t>(std::sqrt(triangles_.size() / 2), 1);
+  cell_ = std::max(max[0] - min_[0], max[1] - min_[1]) / cells_ + epsilon;
+  buckets_.assign(cells_ * cells_, {});
+  for (size_t t = 0; t < triangles_.size(); ++t) {
+    Point2D lo = points_[triangles_[t][0]], hi = lo;
+    for (size_t k = 1; k < 3; ++k)
+      for (size_t c = 0; c < 2; ++c) {
+        lo[c] = std::min(lo[c], points_[triangles_[t][k]][c]);
+        hi[c] = std::max(hi[c], points_[triangles_[t][k]][c]);
+      }
+    size_t i0 = (lo[0] - min_[0]) / cell_, j0 = (lo[1] - min_[1]) / cell_;
+    size_t i1 = std::min<size_t>((hi[0] - min_[0]) / cell_, cells_ - 1);
+    size_t j1 = std::min<size_t>((hi[1] - min_[1]) / cell_, cells_ - 1);
+    for (size_t j = j0; j <= j1; ++j)
+      for (size_t i = i0; i <= i1; ++i)
+        buckets_[j*cells_+i].push_back(t);
+  }
+}
+
+// The location of the last query is kept per thread, as mapToRibbons queries each point n times
+const FEMHarmonic::Location &
+FEMHarmonic::locate(const Point2D &uv) const {
+  thread_local size_t last_generation = 0;
+  thread_local Point2D last_uv;
+  thread_local Location last;
+  if (last_generation == generation_ && last_uv[0] == uv[0] && last_uv[1] == uv[1])
+    return last;
+  last_generation = generation_;
+  last_uv = uv;
+
+  double x = (uv[0] - min_[0]) / cell_, y = (uv[1] - min_[1]) / cell_;
+  if (x >= 0.0 && y >= 0.0 && x < cells_ && y < cells_)
+    for (size_t t : buckets_[(size_t)y * cells_ + (size_t)x]) {
+      const auto &tri = triangles_[t];
+      auto bary = barycentric(points_[tri[0]], points_[tri[1]], points_[tri[2]], uv);
+      if (bary[0] >= -epsilon && bary[1] >= -epsilon && bary[2] >= -epsilon) {
+        last = { t, bary };
+        return last;
+      }
+    }
+  last = closest(uv);
+  return last;
+}
+
+// Clamps a point outside the triangulation onto the closest triangle
+FEMHarmonic::Location
+FEMHarmonic::closest(const Point2D &uv) const {
+  auto distance = [&](size_t t, Point2D &q) {
+                    const auto &tri = triangles_[t];
+                    double best = std::numeric_limits<double>::max();
+                    for (size_t k = 0; k < 3; ++k) {
+                      auto p = closestOnSegment(uv, points_[tri[k]], points_[tri[(k+1)%3]]);
+                      if ((p - uv).norm() < best) {
+                        best = (p - uv).norm();
+                        q = p;
+                      }
+                    }
+                    return best;
+                  };
+  double best = std::numeric_limits<double>::max();
+  Location result = { 0, { 1.0, 0.0, 0.0 } };
+  auto visit = [&](int i, int j) {
+                 if (i < 0 || j < 0 || i >= (int)cells_ || j >= (int)cells_)
+                   return;
+                 for (size_t t : buckets_[j*cells_+i]) {
+                   Point2D q;
+                   double d = distance(t, q);
+                   if (d < best) {
+                     best = d;
+                     const auto &tri = triangles_[t];
+                     result = { t, barycentric(points_[tri[0]], points_[tri[1]],
+                                               points_[tri[2]], q) };
+                   }
+                 }
+               };
+  // Search rings of cells around the point; cells beyond ring r are farther than r cells,
+  // so the search stops when the best distance is within that
+  int x = std::floor((uv[0] - min_[0]) / cell_), y = std::floor((uv[1] - min_[1]) / cell_);
+  int last = cells_ - 1;
+  int first_ring = std::max({ 0, -x, x - last, -y, y - last });
+  int last_ring = std::max({ std::abs(x), std::abs(y), std::abs(x - last), std::abs(y - last) });
+  for (int r = first_ring; r <= last_ring; ++r) {
+    if (r == 0)
+      visit(x, y);
+    for (int i = x - r; r > 0 && i <= x + r; ++i) {
+      visit(i, y - r);
+      visit(i, y + r);
+    }
+    for (int j = y - r + 1; r > 0 && j < y + r; ++j) {
+      visit(x - r, j);
+      visit(x + r, j);
+    }
+    if (best <= r * cell_)
+      break;
+  }
+  return result;
+}
+
+double
+FEMHarmonic::interpolate(size_t i, const Location &loc) const {
+  const auto &tri = triangles_[loc.triangle];
+  double value = 0.0;
+  for (size_t k = 0; k < 3; ++k)
+    value += values_[tri[k]*n_+i] * loc.bary[k];
+  return value;
+}
+
+Vector2D
+FEMHarmonic::gradient(size_t i, const Location &loc) const {
+  const auto &tri = triangles_[loc.triangle];
+  const auto &a = points_[tri[0]], &b = points_[tri[1]], &c = points_[tri[2]];
+  double area = cross(b - a, c - a);
+  // Gradients of the barycentric coordinates
+  Vector2D ga(b[1] - c[1], c[0] - b[0]), gb(c[1] - a[1], a[0] - c[0]), gc(a[1] - b[1], b[0] - a[0]);
+  return (ga * values_[tri[0]*n_+i] + gb * values_[tri[1]*n_+i] + gc * values_[tri[2]*n_+i]) / area;
+}
+
+Point2D
+FEMHarmonic::mapToRibbon(size_t i, const Point2D &uv) const {
+  const auto &loc = locate(uv);
+  Point2D sd;
+  double bi = interpolate(i, loc), bi_1 = interpolate(prev(i), loc);
+  double denom = bi + bi_1;
+  if (denom < epsilon)
+    sd[0] = 0.0;                // should not matter, as sd[1] = 1
+  else
+    sd[0] = bi / denom;
+  sd[1] = 1.0 - denom;
+  return sd;
+}
+
+Point2D
+FEMHarmonic::mapToRibbonDerivatives(size_t i, const Point2D &uv, Vector2DVector &der) const {
+  const auto &loc = locate(uv);
+  double bi = interpolate(i, loc), bi_1 = interpolate(prev(i), loc);
+  Vector2D gi = gradient(i, loc), gi_1 = gradient(prev(i), loc);
+  double denom = bi + bi_1;
+  Point2D sd;
+  Vector2D ds(0.0, 0.0), dd = (gi + gi_1) * -1.0;
+  if (denom < epsilon)
+    sd[0] = 0.0;
+  else {
+    sd[0] = bi / denom;
+    ds = (gi * bi_1 - gi_1 * bi) / (denom * denom);
+  }
+  sd[1] = 1.0 - denom;
+  der = { Vector2D(ds[0], dd[0]), Vector2D(ds[1], dd[1]) };
+  return sd;
+}
+
+size_t
+FEMHarmonic::vertices() const {
+  return points_.size();
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <array>
+
+#include <parameterization.hh>
+
+#include "differentiable-parameterization.hh"
+
+using namespace Geometry;
+using Transfinite::Parameterization;
+
+// Harmonic parameterization solved by linear finite elements on the domain triangulation
+// (as given by CurvedDomain at the specified resolution), instead of a raster.
+// Each side has the same boundary values as in Harmonic (u on side i, 1-u on side i+1,
+// 0 elsewhere), set exactly at the boundary vertices; all sides share one sparse
+// factorization of the cotangent Laplacian. Queries use point location in the triangulation
+// and barycentric interpolation; points outside of it are clamped onto the closest triangle.
+class FEMHarmonic : public Parameterization, public DifferentiableParameterization {
+public:
+  FEMHarmonic(size_t resolution);
+  virtual ~FEMHarmonic();
+  virtual Point2D mapToRibbon(size_t i, const Point2D &uv) const override;
+  // (s, d) with its derivatives by u (der[0]) and by v (der[1]); the gradients are
+  // constant in each triangle
+  virtual Point2D mapToRibbonDerivatives(size_t i, const Point2D &uv,
+                                         Vector2DVector &der) const override;
+  // Throws std::runtime_error when the domain is not a CurvedDomain,
+  // or when the system cannot be solved
+  virtual void update() override;
+  size_t vertices() const;
+private:
+  struct Location {
+    size_t triangle;
+    std::array<double, 3> bary;
+  };
+
+  void buildBuckets();
+  const Location &locate(const Point2D &uv) const;
+  Location closest(const Point2D &uv) const;
+  double interpolate(size_t i, const Location &loc) const;
+  Vector2D gradient(size_t i, const Location &loc) const;
+
+  size_t resolution_, generation_;
+  Point2DVector points_;
+  std::vector<std::array<size_t, 3>> triangles_;
+  DoubleVector values_;         // for each vertex, the values of all sides
+  // Uniform grid of triangle lists for point location
+  Point2D min_;
+  double cell_;
+  size_t cells_;
+  std::vector<std::vector<size_t>> buckets_;
+};
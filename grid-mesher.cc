@@ -0,0 +1,264 @@
+#include "grid-mesher.hh"
+
+#include <algorithm>
+#include <map>
+#include <unordered_set>
+
+#include "morton.hh"
+
+namespace GridMesher {
+
+namespace {
+
+  inline double cross(const Vector2D &a, const Vector2D &b) {
+    return a[0] * b[1] - a[1] * b[0];
+  }
+
+  inline double area(const Point2D &a, const Point2D &b, const Point2D &c) {
+    return cross(b - a, c - a);
+  }
+
+  double segmentDistance(const Point2D &p, const Point2D &a, const Point2D &b) {
+    Vector2D ab = b - a;
+    double t = std::clamp((p - a) * ab / std::max(ab * ab, epsilon), 0.0, 1.0);
+    return (p - (a + ab * t)).norm();
+  }
+
+}
+
+bool triangulate(const Point2DVector &boundary, double spacing,
+                 Point2DVector &vertices, std::vector<Triangle> &triangles) {
+  size_t n = boundary.size();
+  if (n < 3 || spacing <= 0.0)
+    return false;
+
+  // Grid covering the boundary, with one empty layer around it
+  Point2D min = boundary[0], max = boundary[0];
+  for (const auto &p : boundary)
+    for (size_t k = 0; k < 2; ++k) {
+      min[k] = std::min(min[k], p[k]);
+      max[k] = std::max(max[k], p[k]);
+    }
+  min -= Vector2D(spacing, spacing);
+  size_t nx = (max[0] - min[0]) / spacing + 3, ny = (max[1] - min[1]) / spacing + 3;
+  if (nx > 0xffff || ny > 0xffff)
+    return false;
+  auto node = [&](size_t i, size_t j) { return min + Vector2D(i * spacing, j * spacing); };
+
+  // Nodes inside the polygon (even-odd rule along each row)...
+  std::vector<bool> valid(nx * ny, false);
+  for (size_t j = 0; j < ny; ++j) {
+    double y = min[1] + j * spacing;
+    DoubleVector xs;
+    for (size_t k = 0; k < n; ++k) {
+      const auto &a = boundary[k], &b = boundary[(k+1)%n];
+      if ((a[1] <= y) != (b[1] <= y))
+        xs.push_back(a[0] + (y - a[1]) / (b[1] - a[1]) * (b[0] - a[0]));
+    }
+    std::sort(xs.begin(), xs.end());
+    for (size_t k = 0; k + 1 < xs.size(); k += 2) {
+      size_t first = std::ceil((xs[k] - min[0]) / spacing);
+      for (size_t i = first; i < nx && min[0] + i * spacing < xs[k+1]; ++i)
+        valid[j*nx+i] = true;
+    }
+  }
+
+  // ... and not too close to it, to leave room for the boundary strip
+  for (size_t k = 0; k < n; ++k) {
+    const auto &a = boundary[k], &b = boundary[(k+1)%n];
+    double margin = std::max(spacing * 0.6, (b - a).norm() * 0.5);
+    size_t i0 = std::max((std::min(a[0], b[0]) - margin - min[0]) / spacing, 0.0);
+    size_t j0 = std::max((std::min(a[1], b[1]) - margin - min[1]) / spacing, 0.0);
+    size_t i1 = std::min<size_t>((std::max(a[0], b[0]) + margin - min[0]) / spacing + 1, nx - 1);
+    size_t j1 = std::min<size_t>((std::max(a[1], b[1]) + margin - min[1]) / spacing + 1, ny - 1);
+    for (size_t j = j0; j <= j1; ++j)
+      for (size_t i = i0; i <= i1; ++i)
+        if (valid[j*nx+i] && segmentDistance(node(i, j), a, b) < margin)
+          valid[j*nx+i] = false;
+  }
+
+  // Cells with four valid corners
+  size_t cx = nx - 1, cy = ny - 1;
+  std::vector<bool> active(cx * cy, false);
+  for (size_t j = 0; j < cy; ++j)
+    for (size_t i = 0; i < cx; ++i)
+      active[j*cx+i] = valid[j*nx+i] && valid[j*nx+i+1] && valid[(j+1)*nx+i] && valid[(j+1)*nx+i+1];
+  auto isActive = [&](int i, int j) {
+                    return i >= 0 && j >= 0 && i < (int)cx && j < (int)cy && active[j*cx+i];
+                  };
+
+  // Remove cells touching others only at a corner, as the region boundary would pinch there
+  for (bool changed = true; changed; ) {
+    changed = false;
+    for (int j = 0; j <= (int)cy; ++j)
+      for (int i = 0; i <= (int)cx; ++i) {
+        bool a = isActive(i - 1, j - 1), b = isActive(i, j - 1);
+        bool c = isActive(i - 1, j), d = isActive(i, j);
+        if (a && d && !b && !c) {
+          active[j*cx+i] = false;
+          changed = true;
+        } else if (b && c && !a && !d) {
+          active[j*cx+i-1] = false;
+          changed = true;
+        }
+      }
+  }
+
+  // Keep the largest 4-connected component
+  std::vector<int> component(cx * cy, -1);
+  std::vector<size_t> sizes;
+  for (size_t start = 0; start < cx * cy; ++start) {
+    if (!active[start] || component[start] >= 0)
+      continue;
+    int id = sizes.size();
+    size_t count = 0;
+    std::vector<size_t> stack = { start };
+    component[start] = id;
+    while (!stack.empty()) {
+      size_t c = stack.back();
+      stack.pop_back();
+      ++count;
+      int i = c % cx, j = c / cx;
+      const int di[] = { 1, -1, 0, 0 }, dj[] = { 0, 0, 1, -1 };
+      for (size_t k = 0; k < 4; ++k) {
+        int i1 = i + di[k], j1 = j + dj[k];
+        if (isActive(i1, j1) && component[j1*cx+i1] < 0) {
+          component[j1*cx+i1] = id;
+          stack.push_back(j1 * cx + i1);
+        }
+      }
+    }
+    sizes.push_back(count);
+  }
+  if (sizes.empty())
+    return false;
+  int largest = std::max_element(sizes.begin(), sizes.end()) - sizes.begin();
+  for (size_t c = 0; c < cx * cy; ++c)
+    active[c] = component[c] == largest;
+
+  // Boundary of the region: edges of counterclockwise cells without a neighbor on the other side
+  std::map<size_t, size_t> next_node; // node index -> next node index along the boundary
+  size_t boundary_edges = 0;
+  for (int j = 0; j < (int)cy; ++j)
+    for (int i = 0; i < (int)cx; ++i) {
+      if (!isActive(i, j))
+        continue;
+      size_t a = j * nx + i, b = a + 1, c = b + nx, d = a + nx;
+      if (!isActive(i, j - 1)) { next_node[a] = b; ++boundary_edges; }
+      if (!isActive(i + 1, j)) { next_node[b] = c; ++boundary_edges; }
+      if (!isActive(i, j + 1)) { next_node[c] = d; ++boundary_edges; }
+      if (!isActive(i - 1, j)) { next_node[d] = a; ++boundary_edges; }
+    }
+  if (next_node.size() != boundary_edges)
+    return false;               // pinch point
+  std::vector<size_t> inner;
+  size_t start = next_node.begin()->first;
+  for (size_t v = start; inner.empty() || v != start; v = next_node[v]) {
+    inner.push_back(v);
+    if (inner.size() > boundary_edges)
+      return false;
+  }
+  if (inner.size() != boundary_edges)
+    return false;               // several loops (holes)
+
+  // Vertices: the boundary, then the grid nodes of the region in Z-order
+  std::vector<size_t> nodes;
+  {
+    std::vector<bool> used(nx * ny, false);
+    for (int j = 0; j < (int)cy; ++j)
+      for (int i = 0; i < (int)cx; ++i)
+        if (isActive(i, j)) {
+          size_t a = j * nx + i;
+          used[a] = used[a+1] = used[a+nx] = used[a+nx+1] = true;
+        }
+    for (size_t k = 0; k < nx * ny; ++k)
+      if (used[k])
+        nodes.push_back(k);
+  }
+  auto morton = [&](size_t k) { return Morton::index(k % nx, k / nx); };
+  std::sort(nodes.begin(), nodes.end(),
+            [&](size_t a, size_t b) { return morton(a) < morton(b); });
+  std::vector<size_t> index(nx * ny, 0);
+  vertices = boundary;
+  for (size_t k : nodes) {
+    index[k] = vertices.size();
+    vertices.push_back(node(k % nx, k / nx));
+  }
+
+  // Grid triangles, in Z-order of the cells
+  triangles.clear();
+  std::vector<size_t> cells;
+  for (size_t c = 0; c < cx * cy; ++c)
+    if (active[c])
+      cells.push_back(c % cx + (c / cx) * nx);
+  std::sort(cells.begin(), cells.end(),
+            [&](size_t a, size_t b) { return morton(a) < morton(b); });
+  for (size_t a : cells) {
+    size_t b = a + 1, c = b + nx, d = a + nx;
+    triangles.push_back({ index[a], index[b], index[c] });
+    triangles.push_back({ index[a], index[c], index[d] });
+  }
+
+  // Stitch the boundary to the region boundary; both loops should be counterclockwise
+  Point2DVector outer = boundary;
+  std::vector<size_t> outer_index(n);
+  for (size_t k = 0; k < n; ++k)
+    outer_index[k] = k;
+  double signed_area = 0.0;
+  for (size_t k = 0; k < n; ++k)
+    signed_area += cross(boundary[k], boundary[(k+1)%n]);
+  if (signed_area < 0.0) {
+    std::reverse(outer.begin(), outer.end());
+    std::reverse(outer_index.begin(), outer_index.end());
+  }
+  size_t m = inner.size(), offset = 0;
+  for (size_t k = 1; k < m; ++k)
+    if ((vertices[index[inner[k]]] - outer[0]).norm() <
+        (vertices[index[inner[offset]]] - outer[0]).norm())
+      offset = k;
+  auto innerPoint = [&](size_t k) { return vertices[index[inner[(k + offset) % m]]]; };
+  auto innerIndex = [&](size_t k) { return index[inner[(k + offset) % m]]; };
+
+  // Zip the two loops, preferring the shorter diagonal; when the strip would fold over,
+  // backtrack (states already known to be dead ends are not visited again)
+  struct State { size_t i, j, tried; };
+  std::vector<State> path = { { 0, 0, 0 } };
+  std::unordered_set<size_t> dead;
+  while (!path.empty()) {
+    auto [i, j, tried] = path.back();
+    if (i == n && j == m)
+      break;
+    const auto &o = outer[i%n], &o1 = outer[(i+1)%n];
+    auto p = innerPoint(j), p1 = innerPoint(j + 1);
+    bool outer_ok = i < n && area(o, o1, p) > 0.0;
+    bool inner_ok = j < m && area(p1, p, o) > 0.0;
+    bool outer_first = outer_ok && (!inner_ok || (o1 - p).norm() < (p1 - o).norm());
+    bool moves[2] = { outer_first ? outer_ok : inner_ok, outer_first ? inner_ok : outer_ok };
+    if (tried == 2 || (tried == 1 && !moves[1])) {
+      dead.insert(i * (m + 1) + j);
+      path.pop_back();
+      continue;
+    }
+    path.back().tried++;
+    if (!moves[tried])
+      continue;
+    bool advance_outer = (tried == 0) == outer_first;
+    size_t i1 = advance_outer ? i + 1 : i, j1 = advance_outer ? j : j + 1;
+    if (!dead.count(i1 * (m + 1) + j1))
+      path.push_back({ i1, j1, 0 });
+  }
+  if (path.empty())
+    return false;               // the strip would fold over
+
+  for (size_t k = 1; k < path.size(); ++k) {
+    size_t i = path[k-1].i, j = path[k-1].j;
+    if (path[k].i > i)
+      triangles.push_back({ outer_index[i%n], outer_index[(i+1)%n], innerIndex(j) });
+    else
+      triangles.push_back({ innerIndex(j + 1), innerIndex(j), outer_index[i%n] });
+  }
+
+  return true;
+}
+
+}
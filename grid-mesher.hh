@@ -0,0 +1,21 @@
+#pragma once
+
+#include <array>
+
+#include <geometry.hh>
+
+namespace GridMesher {
+
+using namespace Geometry;
+using Triangle = std::array<size_t, 3>;
+
+// Triangulates a closed polygon (the boundary samples) with a regular grid of the given spacing,
+// clipped to the inside of the polygon, and a strip stitching the grid to the boundary.
+// The output starts with the boundary points, followed by the grid points in Z-order;
+// the triangles are counterclockwise.
+// Returns false when the clipped grid is not a single simply connected region
+// (e.g. in narrow domains); the caller should use a general mesher then.
+bool triangulate(const Point2DVector &boundary, double spacing,
+                 Point2DVector &vertices, std::vector<Triangle> &triangles);
+
+}
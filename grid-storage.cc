@@ -0,0 +1,23 @@
+#include "grid-storage.hh"
+
+#include <cstdio>
+#include <stdexcept>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+std::shared_ptr<void> mapTemporaryFile(size_t bytes) {
+  if (bytes == 0)
+    bytes = 1;
+  FILE *file = std::tmpfile();  // removed when closed
+  if (!file)
+    throw std::runtime_error("cannot create a temporary file for spilling");
+  int fd = fileno(file);
+  void *data = MAP_FAILED;
+  if (ftruncate(fd, bytes) == 0)
+    data = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  std::fclose(file);            // the mapping keeps the file alive
+  if (data == MAP_FAILED)
+    throw std::runtime_error("cannot map a temporary file for spilling");
+  return std::shared_ptr<void>(data, [bytes](void *p) { munmap(p, bytes); });
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "memory-usage.hh"
+
+// Maps an unlinked temporary file of the given size; throws std::runtime_error on failure.
+// The mapping is released by the deleter of the returned pointer.
+std::shared_ptr<void> mapTemporaryFile(size_t bytes);
+
+// Fixed-size array in memory, or in a memory-mapped temporary file
+template<typename T>
+class GridStorage {
+public:
+  GridStorage() = default;
+  GridStorage(const GridStorage &) = delete;
+  GridStorage(GridStorage &&) = default;
+  GridStorage &operator=(const GridStorage &) = delete;
+  GridStorage &operator=(GridStorage &&) = default;
+
+  // Zero-initialized
+  void allocate(size_t size, bool spill) {
+    memory_.clear();
+    memory_.shrink_to_fit();
+    file_.reset();
+    if (spill) {
+      file_ = mapTemporaryFile(size * sizeof(T));
+      data_ = static_cast<T *>(file_.get());
+    } else {
+      memory_.assign(size, T(0));
+      data_ = memory_.data();
+    }
+    size_ = size;
+  }
+  T &operator[](size_t i) { return data_[i]; }
+  const T &operator[](size_t i) const { return data_[i]; }
+  size_t size() const { return size_; }
+  bool spilled() const { return (bool)file_; }
+
+private:
+  std::vector<T> memory_;
+  std::shared_ptr<void> file_;
+  T *data_ = nullptr;
+  size_t size_ = 0;
+};
@@ -1,33 +1,262 @@
 #include "harmonic.hh"
 
 #include <algorithm>
+#include <array>
+#include <atomic>
 #include <cmath>
 #include <fstream>
+#include <functional>
+#include <mutex>
 #include <sstream>
+#include <stdexcept>
+#include <thread>
 
+#include "curve-sampler.hh"
 #include "curved-domain.hh"
 
-Harmonic::Harmonic(size_t levels) : levels_(levels) {
+Harmonic::Harmonic(size_t levels)
+  : requested_levels_(levels), levels_(levels), threads_(1), target_error_(0.0),
+    precision_(Precision::DOUBLE), stored_({ Precision::DOUBLE, false, false }),
+    interpolation_(Interpolation::BILINEAR), precompute_gradients_(false), memory_budget_(0),
+    solver_memory_(0), budget_policy_(BudgetPolicy::REFUSE), progress_level_(0), lazy_(false),
+    spill_(false) {
   size_ = std::pow(2, levels_);
 }
 
 Harmonic::~Harmonic() {
 }
 
+namespace {
+
+  // Grid levels for automatic and downgraded resolution
+  const size_t min_levels = 6, max_levels = 11;
+
+  // Position of grid node (u, v) in the (row-major) storage
+  struct GridIndex {
+    size_t size;
+    size_t operator()(size_t u, size_t v) const { return v * size + u; }
+  };
+
+  // Positions of the nodes (u + first .. u + last) x (v + first .. v + last) around (u, v),
+  // clamped at the frame of the grid; the row offsets are computed once per lookup
+  template<int first, int last>
+  struct Stencil {
+    int u, v;
+    std::array<size_t, last - first + 1> columns, rows;
+    Stencil(const GridIndex &idx, int u, int v) : u(u), v(v) {
+      int end = idx.size - 1;
+      for (int k = first; k <= last; ++k) {
+        columns[k-first] = std::clamp(u + k, 0, end);
+        rows[k-first] = std::clamp(v + k, 0, end) * idx.size;
+      }
+    }
+    size_t operator()(int i, int j) const { return columns[i-u-first] + rows[j-v-first]; }
+  };
+
+  // Bilinear interpolation of the node values f(u, v)
+  template<typename F>
+  double bilinear(F f, double x, double y) {
+    int u = std::round(x), v = std::round(y);
+    double value;
+    value = f(u, v) * (1.0 - y + v) * (1.0 - x + u);
+    value += f(u, v + 1) * (y - v) * (1.0 - x + u);
+    value += f(u + 1, v) * (1.0 - y + v) * (x - u);
+    value += f(u + 1, v + 1) * (y - v) * (x - u);
+    return value;
+  }
+
+  template<typename M>
+  double bilinear(const M &m, const GridIndex &idx, double x, double y) {
+    Stencil<0, 1> s(idx, std::round(x), std::round(y));
+    return bilinear([&](int u, int v) { return (double)m[s(u, v)]; }, x, y);
+  }
+
+  // Bilinear interpolation of the central differences at the grid nodes (in grid units)
+  template<typename M>
+  Vector2D gradient(const M &m, const GridIndex &idx, double x, double y) {
+    Stencil<-1, 2> s(idx, std::round(x), std::round(y));
+    auto du = [&](int u, int v) { return ((double)m[s(u+1, v)] - m[s(u-1, v)]) / 2.0; };
+    auto dv = [&](int u, int v) { return ((double)m[s(u, v+1)] - m[s(u, v-1)]) / 2.0; };
+    return Vector2D(bilinear(du, x, y), bilinear(dv, x, y));
+  }
+
+  template<typename M>
+  void gradientFields(const M &m, const GridIndex &idx, bool spill,
+                      GridStorage<float> &du, GridStorage<float> &dv) {
+    size_t size = idx.size;
+    du.allocate(size * size, spill);
+    dv.allocate(size * size, spill);
+    for (size_t v = 1; v + 1 < size; ++v)
+      for (size_t u = 1; u + 1 < size; ++u) {
+        du[idx(u, v)] = ((double)m[idx(u+1, v)] - m[idx(u-1, v)]) / 2.0;
+        dv[idx(u, v)] = ((double)m[idx(u, v+1)] - m[idx(u, v-1)]) / 2.0;
+      }
+  }
+
+  // Copies the values of a solved grid into the storage
+  template<typename T, typename S>
+  void storeValues(const BasicHarmonicMap<T> &grid, const GridIndex &idx, bool spill,
+                   GridStorage<S> &result) {
+    size_t size = idx.size;
+    result.allocate(size * size, spill);
+    for (size_t v = 0, k = 0; v < size; ++v)
+      for (size_t u = 0; u < size; ++u, ++k)
+        result[idx(u, v)] = grid[k].value;
+  }
+
+  // Catmull-Rom weights of the samples at -1, 0, 1, 2 for a parameter t in [0, 1]
+  inline std::array<double, 4> cubicWeights(double t) {
+    double t2 = t * t, t3 = t2 * t;
+    return { (-t3 + 2.0 * t2 - t) / 2.0, (3.0 * t3 - 5.0 * t2 + 2.0) / 2.0,
+             (-3.0 * t3 + 4.0 * t2 + t) / 2.0, (t3 - t2) / 2.0 };
+  }
+
+  // Derivatives of the Catmull-Rom weights by t
+  inline std::array<double, 4> cubicDerivatives(double t) {
+    double t2 = t * t;
+    return { (-3.0 * t2 + 4.0 * t - 1.0) / 2.0, (9.0 * t2 - 10.0 * t) / 2.0,
+             (-9.0 * t2 + 8.0 * t + 1.0) / 2.0, (3.0 * t2 - 2.0 * t) / 2.0 };
+  }
+
+  // Sum of the 4x4 node values of the stencil with the given weights
+  template<typename M>
+  double cubicSum(const M &m, const Stencil<-1, 2> &s,
+                  const std::array<double, 4> &wx, const std::array<double, 4> &wy) {
+    double value = 0.0;
+    for (int j = 0; j < 4; ++j) {
+      double row = 0.0;
+      for (int i = 0; i < 4; ++i)
+        row += m[s.columns[i] + s.rows[j]] * wx[i];
+      value += row * wy[j];
+    }
+    return value;
+  }
+
+  template<typename M>
+  double bicubic(const M &m, const GridIndex &idx, double x, double y) {
+    int u = std::floor(x), v = std::floor(y);
+    return cubicSum(m, Stencil<-1, 2>(idx, u, v), cubicWeights(x - u), cubicWeights(y - v));
+  }
+
+  // Derivatives of the bicubic interpolant (in grid units)
+  template<typename M>
+  Vector2D bicubicGradient(const M &m, const GridIndex &idx, double x, double y) {
+    int u = std::floor(x), v = std::floor(y);
+    Stencil<-1, 2> s(idx, u, v);
+    auto wx = cubicWeights(x - u), wy = cubicWeights(y - v);
+    return Vector2D(cubicSum(m, s, cubicDerivatives(x - u), wy),
+                    cubicSum(m, s, wx, cubicDerivatives(y - v)));
+  }
+
+  // Nodes outside the domain (reachable from the frame of the grid without crossing
+  // the boundary) by their chessboard distance from it: 1 and 2 for the nodes that
+  // bicubic stencils inside the domain can reach, 3 farther out; 0 for all other nodes
+  std::vector<uint8_t> outsideRings(const std::vector<bool> &boundary, size_t size) {
+    std::vector<uint8_t> rings(size * size, 0);
+    std::vector<size_t> stack;
+    auto visit = [&](size_t k) {
+                   if (!boundary[k] && rings[k] == 0) {
+                     rings[k] = 3;
+                     stack.push_back(k);
+                   }
+                 };
+    for (size_t i = 0; i < size; ++i) {
+      visit(i);
+      visit((size - 1) * size + i);
+      visit(i * size);
+      visit(i * size + size - 1);
+    }
+    while (!stack.empty()) {
+      size_t k = stack.back(), u = k % size, v = k / size;
+      stack.pop_back();
+      if (u > 0) visit(k - 1);
+      if (u + 1 < size) visit(k + 1);
+      if (v > 0) visit(k - size);
+      if (v + 1 < size) visit(k + size);
+    }
+    for (uint8_t ring = 1; ring <= 2; ++ring)
+      for (size_t v = 0; v < size; ++v)
+        for (size_t u = 0; u < size; ++u) {
+          if (rings[v*size+u] != 3)
+            continue;
+          bool near = false;
+          for (size_t j = v > 0 ? v - 1 : 0; !near && j <= std::min(v + 1, size - 1); ++j)
+            for (size_t i = u > 0 ? u - 1 : 0; !near && i <= std::min(u + 1, size - 1); ++i)
+              near = rings[j*size+i] < ring;
+          if (near)
+            rings[v*size+u] = ring;
+        }
+    return rings;
+  }
+
+  // Replaces the values of rings 1 and 2 outside the domain by linear extrapolation
+  // from the inside, so the bicubic stencils near the boundary see a smooth continuation
+  // of the map instead of the kink towards the (also relaxed) exterior
+  template<typename M>
+  void extrapolateOutside(M &m, const GridIndex &idx, const std::vector<uint8_t> &rings) {
+    int size = idx.size;
+    for (uint8_t ring = 1; ring <= 2; ++ring)
+      for (int v = 0; v < size; ++v)
+        for (int u = 0; u < size; ++u) {
+          if (rings[v*size+u] != ring)
+            continue;
+          auto known = [&](int i, int j) {
+                         return i >= 0 && j >= 0 && i < size && j < size && rings[j*size+i] < ring;
+                       };
+          double sum = 0.0, mean = 0.0;
+          size_t count = 0, near = 0;
+          for (int dv = -1; dv <= 1; ++dv)
+            for (int du = -1; du <= 1; ++du)
+              if ((du != 0 || dv != 0) && known(u + du, v + dv)) {
+                double f1 = m[idx(u + du, v + dv)];
+                mean += f1;
+                ++near;
+                if (known(u + 2 * du, v + 2 * dv)) {
+                  sum += 2.0 * f1 - m[idx(u + 2 * du, v + 2 * dv)];
+                  ++count;
+                }
+              }
+          m[idx(u, v)] = count > 0 ? sum / count : mean / near;
+        }
+  }
+
+}
+
+double
+Harmonic::interpolate(size_t j, const Point2D &uv) const {
+  double x = uv[0] * size_, y = uv[1] * size_;
+  GridIndex idx = { size_ };
+  auto lookup = [&](const auto &m) {
+                  return stored_.cubic ? bicubic(m, idx, x, y) : bilinear(m, idx, x, y);
+                };
+  if (stored_.precision == Precision::DOUBLE)
+    return lookup(maps_[j]);
+  return lookup(float_maps_[j]);
+}
+
+Vector2D
+Harmonic::interpolateGradient(size_t j, const Point2D &uv) const {
+  double x = uv[0] * size_, y = uv[1] * size_;
+  GridIndex idx = { size_ };
+  if (stored_.cubic) {
+    if (stored_.precision == Precision::DOUBLE)
+      return bicubicGradient(maps_[j], idx, x, y) * size_;
+    return bicubicGradient(float_maps_[j], idx, x, y) * size_;
+  }
+  if (!gradients_.empty())
+    return Vector2D(bilinear(gradients_[2*j], idx, x, y),
+                    bilinear(gradients_[2*j+1], idx, x, y)) * size_;
+  if (stored_.precision == Precision::DOUBLE)
+    return gradient(maps_[j], idx, x, y) * size_;
+  return gradient(float_maps_[j], idx, x, y) * size_;
+}
+
 Point2D
 Harmonic::mapToRibbon(size_t i, const Point2D &uv) const {
-  double x = uv[0] * size_, y = uv[1] * size_, value;
-  int u = std::round(x), v = std::round(y);
-  auto bc = [&](size_t j) {
-              const auto &m = maps_[j];
-              value = m[v*size_+u].value * (1.0 - y + v) * (1.0 - x + u);
-              value += m[(v+1)*size_+u].value * (y - v) * (1.0 - x + u);
-              value += m[v*size_+u+1].value * (1.0 - y + v) * (x - u);
-              value += m[(v+1)*size_+u+1].value * (y - v) * (x - u);
-              return value;
-            };
+  ensureSide(i);
+  ensureSide(prev(i));
   Point2D sd;
-  double bi = bc(i), bi_1 = bc(prev(i));
+  double bi = interpolate(i, uv), bi_1 = interpolate(prev(i), uv);
   double denom = bi + bi_1;
   if (denom < epsilon)
     sd[0] = 0.0;                // should not matter, as sd[1] = 1
@@ -37,9 +266,30 @@ Harmonic::mapToRibbon(size_t i, const Point2D &uv) const {
   return sd;
 }
 
+Point2D
+Harmonic::mapToRibbonDerivatives(size_t i, const Point2D &uv, Vector2DVector &der) const {
+  ensureSide(i);
+  ensureSide(prev(i));
+  double bi = interpolate(i, uv), bi_1 = interpolate(prev(i), uv);
+  Vector2D gi = interpolateGradient(i, uv), gi_1 = interpolateGradient(prev(i), uv);
+  double denom = bi + bi_1;
+  Point2D sd;
+  Vector2D ds(0.0, 0.0), dd = (gi + gi_1) * -1.0;
+  if (denom < epsilon)
+    sd[0] = 0.0;
+  else {
+    sd[0] = bi / denom;
+    ds = (gi * bi_1 - gi_1 * bi) / (denom * denom);
+  }
+  sd[1] = 1.0 - denom;
+  der = { Vector2D(ds[0], dd[0]), Vector2D(ds[1], dd[1]) };
+  return sd;
+}
+
 namespace {
 
-    void writePPM(const HarmonicMap &m, std::string filename) {
+  template<typename T>
+  void writePPM(const BasicHarmonicMap<T> &m, std::string filename) {
     size_t n = std::round(std::sqrt(m.size()));
     std::ofstream f(filename);
     f << "P3\n" << n << ' ' << n << "\n255\n";
@@ -53,46 +303,53 @@ namespace {
     }
   }
 
-  void solve(HarmonicMap &grid, size_t level) {
-    size_t n = (size_t)std::pow(2, level);
-    if (level > 3) {
-      // Generate a coarser grid and solve that first to get good starting values
-      size_t level1 = level - 1, n1 = (size_t)std::pow(2, level1);
-      HarmonicMap grid1(n1 * n1);
-      for (size_t i = 0; i < n1; ++i)
-        for (size_t j = 0; j < n1; ++j) {
-          grid1[j*n1+i].value = 0.0;
-          int count = 0;
-          if (grid[2*j*n+2*i].boundary) {
-            ++count;
-            grid1[j*n1+i].value += grid[2*j*n+2*i].value;
-          }
-          if (grid[2*j*n+2*i+1].boundary) {
-            ++count;
-            grid1[j*n1+i].value += grid[2*j*n+2*i+1].value;
-          }
-          if (grid[(2*j+1)*n+2*i].boundary) {
-            ++count;
-            grid1[j*n1+i].value += grid[(2*j+1)*n+2*i].value;
-          }
-          if (grid[(2*j+1)*n+2*i+1].boundary) {
-            ++count;
-            grid1[j*n1+i].value += grid[(2*j+1)*n+2*i+1].value;
-          }
-          if (count > 0) {
-            grid1[j*n1+i].boundary = true;
-            grid1[j*n1+i].value /= (double)count;
-          }
-          else
-            grid1[j*n1+i].boundary = false;
+  // Averages the boundary values of 2x2 blocks into the coarser grid of the next level
+  template<typename T>
+  void restrictGrid(const BasicHarmonicMap<T> &grid, size_t level, BasicHarmonicMap<T> &grid1) {
+    size_t n = (size_t)std::pow(2, level), n1 = n / 2;
+    grid1.resize(n1 * n1);
+    for (size_t i = 0; i < n1; ++i)
+      for (size_t j = 0; j < n1; ++j) {
+        grid1[j*n1+i].value = 0.0;
+        int count = 0;
+        if (grid[2*j*n+2*i].boundary) {
+          ++count;
+          grid1[j*n1+i].value += grid[2*j*n+2*i].value;
         }
-      solve(grid1, level1);
-      for (size_t i = 0; i < n; ++i)
-        for (size_t j = 0; j < n; ++j)
-          if (!grid[j*n+i].boundary)
-            grid[j*n+i].value = grid1[(j/2)*n1+i/2].value;
-    }
+        if (grid[2*j*n+2*i+1].boundary) {
+          ++count;
+          grid1[j*n1+i].value += grid[2*j*n+2*i+1].value;
+        }
+        if (grid[(2*j+1)*n+2*i].boundary) {
+          ++count;
+          grid1[j*n1+i].value += grid[(2*j+1)*n+2*i].value;
+        }
+        if (grid[(2*j+1)*n+2*i+1].boundary) {
+          ++count;
+          grid1[j*n1+i].value += grid[(2*j+1)*n+2*i+1].value;
+        }
+        if (count > 0) {
+          grid1[j*n1+i].boundary = true;
+          grid1[j*n1+i].value /= (double)count;
+        }
+        else
+          grid1[j*n1+i].boundary = false;
+      }
+  }
+
+  // Starting values from the solution of the coarser grid
+  template<typename T>
+  void prolongGrid(const BasicHarmonicMap<T> &grid1, size_t level, BasicHarmonicMap<T> &grid) {
+    size_t n = (size_t)std::pow(2, level), n1 = n / 2;
+    for (size_t i = 0; i < n; ++i)
+      for (size_t j = 0; j < n; ++j)
+        if (!grid[j*n+i].boundary)
+          grid[j*n+i].value = grid1[(j/2)*n1+i/2].value;
+  }
 
+  template<typename T>
+  void relax(BasicHarmonicMap<T> &grid, size_t level) {
+    size_t n = (size_t)std::pow(2, level);
     double change;
     do {
       change = 0.0;
@@ -115,71 +372,417 @@ namespace {
       change /= (double)count;
     } while (change > 1.0e-5);  // kutykurutty [much smaller values slow down the algorithm]
   }
-  
+
+  template<typename T>
+  void solve(BasicHarmonicMap<T> &grid, size_t level) {
+    if (level > 3) {
+      // Generate a coarser grid and solve that first to get good starting values
+      // The coarse grids are kept per thread, so batch workers reuse them between patches
+      thread_local std::vector<BasicHarmonicMap<T>> scratch;
+      size_t level1 = level - 1;
+      if (scratch.size() <= level1)
+        scratch.resize(level1 + 1);
+      auto &grid1 = scratch[level1];
+      restrictGrid(grid, level, grid1);
+      solve(grid1, level1);
+      prolongGrid(grid1, level, grid);
+    }
+    relax(grid, level);
+  }
+
+  // Rings outside the domain, from the boundary nodes of a solver grid
+  template<typename T>
+  std::vector<uint8_t> outsideRings(const BasicHarmonicMap<T> &grid, size_t size) {
+    std::vector<bool> boundary(size * size);
+    for (size_t k = 0; k < size * size; ++k)
+      boundary[k] = grid[k].boundary;
+    return outsideRings(boundary, size);
+  }
+
+  // Smallest boundary feature of the (scaled) domain: the shortest side,
+  // the smallest radius of curvature, and the distance between non-adjacent sides.
+  double featureSize(const std::vector<BSCurve> &curves) {
+    const size_t samples = 50;
+    size_t n = curves.size();
+    std::vector<Point2DVector> points(n);
+    double feature = 1.0;
+    for (size_t i = 0; i < n; ++i) {
+      double length = 0.0;
+      VectorVector der;
+      for (size_t k = 0; k <= samples; ++k) {
+        double u = (double)k / samples;
+        auto p = curves[i].eval(u, 2, der);
+        points[i].emplace_back(p[0], p[1]);
+        if (k > 0)
+          length += (points[i][k] - points[i][k-1]).norm();
+        double speed = Vector2D(der[1][0], der[1][1]).norm();
+        double cross = std::abs(der[1][0] * der[2][1] - der[1][1] * der[2][0]);
+        if (cross > epsilon)
+          feature = std::min(feature, std::pow(speed, 3) / cross);
+      }
+      feature = std::min(feature, length);
+    }
+    for (size_t i = 0; i < n; ++i)
+      for (size_t j = i + 2; j < n; ++j) {
+        if (i == 0 && j == n - 1)
+          continue;             // adjacent
+        for (const auto &p : points[i])
+          for (const auto &q : points[j])
+            feature = std::min(feature, (p - q).norm());
+      }
+    return feature;
+  }
+
 }
 
 void
-Harmonic::update() {
-  const size_t resolution = size_ / 10;
+Harmonic::setThreads(size_t threads) {
+  threads_ = std::max<size_t>(threads, 1);
+}
+
+void
+Harmonic::setAutoLevels(double target_error) {
+  target_error_ = target_error;
+}
+
+size_t
+Harmonic::levels() const {
+  return levels_;
+}
+
+void
+Harmonic::setPrecision(Precision precision) {
+  precision_ = precision;
+}
+
+Harmonic::Precision
+Harmonic::precision() const {
+  return precision_;
+}
+
+void
+Harmonic::setInterpolation(Interpolation interpolation) {
+  interpolation_ = interpolation;
+}
+
+Harmonic::Interpolation
+Harmonic::interpolation() const {
+  return interpolation_;
+}
+
+void
+Harmonic::setGradients(bool precompute) {
+  precompute_gradients_ = precompute;
+}
+
+void
+Harmonic::setLazy(bool lazy) {
+  lazy_ = lazy;
+}
+
+void
+Harmonic::setProgress(size_t first_level, std::function<void(size_t)> progress) {
+  progress_level_ = first_level;
+  progress_ = progress;
+}
+
+void
+Harmonic::setMemoryBudget(size_t bytes, BudgetPolicy policy) {
+  memory_budget_ = bytes;
+  budget_policy_ = policy;
+}
+
+MemoryUsage
+Harmonic::memoryUsage() const {
+  MemoryUsage usage;
+  auto add = [&](size_t count, size_t bytes, bool spilled) {
+               (spilled ? usage.spilled : usage.grids) += count * bytes;
+             };
+  for (const auto &m : maps_)
+    add(m.size(), sizeof(double), m.spilled());
+  for (const auto &m : float_maps_)
+    add(m.size(), sizeof(float), m.spilled());
+  for (const auto &g : gradients_)
+    add(g.size(), sizeof(float), g.spilled());
+  usage.caches = boundary_.capacity() * sizeof(BoundaryCell) + rings_.capacity();
+  usage.solver = solver_memory_;
+  return usage;
+}
+
+// Solved maps and gradient fields
+size_t
+Harmonic::gridMemory(size_t levels) const {
+  size_t cells = (size_t)1 << (2 * levels);
+  size_t value = precision_ == Precision::DOUBLE ? sizeof(double) : sizeof(float);
+  bool fields = precompute_gradients_ && interpolation_ == Interpolation::BILINEAR;
+  size_t gradients = fields ? 2 * sizeof(float) : 0;
+  return n_ * cells * (value + gradients);
+}
+
+// Grids in relaxation: the full grid and the coarser ones (1/3 more) for each thread,
+// or for all sides in a progressive update
+size_t
+Harmonic::solverMemory(size_t levels, size_t threads) const {
+  size_t cells = (size_t)1 << (2 * levels);
+  size_t value = precision_ == Precision::SINGLE ? sizeof(BasicGridValue<float>) : sizeof(GridValue);
+  size_t grids = progress_ ? n_ : std::min(threads, n_);
+  return grids * cells * value * 4 / 3;
+}
+
+// Applies the budget policy to levels_ and the solver threads; throws when it cannot fit
+void
+Harmonic::fitBudget(size_t &threads, bool &spill) {
+  spill = false;
+  if (memory_budget_ == 0)
+    return;
+  auto required = [&]() {
+                    return (spill ? 0 : gridMemory(levels_)) + solverMemory(levels_, threads);
+                  };
+  if (budget_policy_ == BudgetPolicy::DOWNGRADE)
+    while (required() > memory_budget_ && levels_ > min_levels)
+      --levels_;
+  else if (budget_policy_ == BudgetPolicy::SPILL && required() > memory_budget_) {
+    spill = true;
+    threads = 1;
+  }
+  size_ = std::pow(2, levels_);
+  if (required() > memory_budget_) {
+    std::stringstream message;
+    message << "harmonic parameterization needs " << (required() >> 20) << " MB at level "
+            << levels_ << ", but the memory budget is " << (memory_budget_ >> 20) << " MB";
+    throw std::runtime_error(message.str());
+  }
+}
+
+// Each curve is drawn as a polyline with segments of at most about one grid cell
+// (its control polygon bounds its length), so the polyline stays within the cells
+// of the curve even on coarse grids
+void
+Harmonic::rasterizeBoundary() {
   const auto &curves = dynamic_cast<CurvedDomain *>(domain_.get())->boundaries();
-  n_ = curves.size();
-  maps_.clear();
-  for (size_t i = 0; i < n_; ++i) {
-    HarmonicMap m(size_ * size_);
-    for (auto &g : m) {
-      g.boundary = false;
-      g.value = 0.0;
-    }
-    for (size_t j = 0; j < n_; ++j) {
-      const auto &c = curves[j];
-      Point3D from, to = c.eval(0.0);
-      if (j == next(i))
-        to[2] = 1.0;
-      for (size_t k = 1; k <= resolution; ++k) {
-        from = to;
-        double u = (double)k / resolution;
-        to = c.eval(u);
-        if (j == i)
-          to[2] = u;
-        else if (j == next(i))
-          to[2] = 1.0 - u;
-        // Line drawing:
-        int x0 = from[0] * size_, y0 = from[1] * size_;
-        int x1 = to[0] * size_, y1 = to[1] * size_;
-        double v0 = from[2], v1 = to[2];
-        int dx = abs(x1 - x0), sx = x0 < x1 ? 1 : -1;
-        int dy = abs(y1 - y0), sy = y0 < y1 ? 1 : -1;
-        int err = (dx > dy ? dx : -dy) / 2, e2;
-        if (err == 0) {
-          m[y0*size_+x0].boundary = true;
-          m[y0*size_+x0].value = v0;
-          m[y1*size_+x1].boundary = true;
-          m[y1*size_+x1].value = v1;
-          continue;
-        }
-        while (true) {
-          double ratio;
-          if (err > 0)
-            ratio = (double)std::abs(x1 - x0) / (double)dx;
-          else
-            ratio = (double)std::abs(y1 - y0) / (double)dy;
-          m[y0*size_+x0].boundary = true;
-          m[y0*size_+x0].value = v0 * ratio + v1 * (1.0 - ratio);
-          if (x0 == x1 && y0 == y1) break;
-          e2 = err;
-          if (e2 > -dx) { err -= dy; x0 += sx; }
-          if (e2 <  dy) { err += dx; y0 += sy; }
-        }
+  boundary_.clear();
+  PointVector points;
+  for (size_t j = 0; j < n_; ++j) {
+    // Consecutive segments share their end cells, which are stored once, with the last value
+    auto add = [&](size_t index, double u) {
+                 if (!boundary_.empty() && boundary_.back().index == index &&
+                     boundary_.back().curve == j)
+                   boundary_.back().u = u;
+                 else
+                   boundary_.push_back({ index, j, u });
+               };
+    const auto &cp = curves[j].controlPoints();
+    double length = 0.0;
+    for (size_t k = 1; k < cp.size(); ++k)
+      length += (cp[k] - cp[k-1]).norm();
+    size_t resolution = std::max<size_t>(std::ceil(length * size_), size_ / 10);
+    auto us = CurveSampler::uniform(resolution, true);
+    CurveSampler::eval(curves[j], us, points);
+    Point3D from, to = points[0];
+    double from_u, to_u = 0.0;
+    for (size_t k = 1; k <= resolution; ++k) {
+      from = to;
+      from_u = to_u;
+      to_u = us[k];
+      to = points[k];
+      // Line drawing:
+      int x0 = from[0] * size_, y0 = from[1] * size_;
+      int x1 = to[0] * size_, y1 = to[1] * size_;
+      int dx = abs(x1 - x0), sx = x0 < x1 ? 1 : -1;
+      int dy = abs(y1 - y0), sy = y0 < y1 ? 1 : -1;
+      int err = (dx > dy ? dx : -dy) / 2, e2;
+      if (err == 0) {
+        add(y0 * size_ + x0, from_u);
+        add(y1 * size_ + x1, to_u);
+        continue;
+      }
+      while (true) {
+        double ratio;
+        if (err > 0)
+          ratio = (double)std::abs(x1 - x0) / (double)dx;
+        else
+          ratio = (double)std::abs(y1 - y0) / (double)dy;
+        add(y0 * size_ + x0, from_u * ratio + to_u * (1.0 - ratio));
+        if (x0 == x1 && y0 == y1) break;
+        e2 = err;
+        if (e2 > -dx) { err -= dy; x0 += sx; }
+        if (e2 <  dy) { err += dx; y0 += sy; }
       }
     }
-    solve(m, levels_);
-    maps_.push_back(m);
-
-    // Parameterization debug output
-    if (false) {
-      std::stringstream fname;
-      fname << "/tmp/domain-" << i << ".ppm";
-      writePPM(m, fname.str());
-    }
   }
 }
+
+template<typename T>
+BasicHarmonicMap<T>
+Harmonic::initSide(size_t i) const {
+  BasicHarmonicMap<T> m(size_ * size_);
+  for (auto &g : m) {
+    g.boundary = false;
+    g.value = 0.0;
+  }
+  // Boundary values: u on side i, 1-u on side i+1, 0 elsewhere
+  // (cells are written in drawing order, so later curves overwrite shared cells)
+  size_t i1 = next(i);
+  for (const auto &cell : boundary_) {
+    auto &g = m[cell.index];
+    g.boundary = true;
+    g.value = cell.curve == i ? cell.u : (cell.curve == i1 ? 1.0 - cell.u : 0.0);
+  }
+  return m;
+}
+
+template<typename T>
+void
+Harmonic::storeSide(size_t i, const BasicHarmonicMap<T> &m) {
+  GridIndex idx = { size_ };
+  auto store = [&](auto &values) {
+                 storeValues(m, idx, spill_, values);
+                 if (stored_.cubic)
+                   extrapolateOutside(values, idx, rings_);
+                 else if (stored_.gradients)
+                   gradientFields(values, idx, spill_, gradients_[2*i], gradients_[2*i+1]);
+               };
+  if (stored_.precision == Precision::DOUBLE)
+    store(maps_[i]);
+  else
+    store(float_maps_[i]);
+}
+
+void
+Harmonic::solveAndStore(size_t i) {
+  if (stored_.precision == Precision::SINGLE)
+    storeSide(i, solveSide<float>(i));
+  else
+    storeSide(i, solveSide<double>(i));
+}
+
+// In lazy mode, solves the map of side i on first use
+void
+Harmonic::ensureSide(size_t i) const {
+  if (solved_)
+    std::call_once(solved_[i], [&]() {
+                                 std::lock_guard<std::mutex> lock(lazy_mutex_);
+                                 const_cast<Harmonic *>(this)->solveAndStore(i);
+                               });
+}
+
+template<typename T>
+BasicHarmonicMap<T>
+Harmonic::solveSide(size_t i) const {
+  auto m = initSide<T>(i);
+  solve(m, levels_);
+
+  // Parameterization debug output
+  if (false) {
+    std::stringstream fname;
+    fname << "/tmp/domain-" << i << ".ppm";
+    writePPM(m, fname.str());
+  }
+
+  return m;
+}
+
+void
+Harmonic::update() {
+  const auto &curves = dynamic_cast<CurvedDomain *>(domain_.get())->boundaries();
+  n_ = curves.size();
+  levels_ = requested_levels_;
+  if (target_error_ > 0.0) {
+    // A parameter varies by O(1) over the smallest feature, so a cell size of
+    // feature * target_error keeps the interpolation error around target_error.
+    double cell = featureSize(curves) * target_error_;
+    levels_ = std::clamp(std::ceil(std::log2(1.0 / cell)), (double)min_levels, (double)max_levels);
+  }
+  size_ = std::pow(2, levels_);
+  size_t nthreads = std::min(threads_, n_);
+  bool spill;
+  fitBudget(nthreads, spill);
+  solver_memory_ = solverMemory(levels_, nthreads);
+
+  spill_ = spill;
+  rings_.clear();
+  bool cubic = interpolation_ == Interpolation::BICUBIC;
+  stored_ = { precision_, cubic, precompute_gradients_ && !cubic };
+  solved_.reset();
+  rasterizeBoundary();
+  auto clear = [&]() {
+                 maps_.clear();
+                 float_maps_.clear();
+                 gradients_.clear();
+                 if (stored_.precision == Precision::DOUBLE)
+                   maps_.resize(n_);
+                 else
+                   float_maps_.resize(n_);
+                 if (stored_.gradients)
+                   gradients_.resize(2 * n_);
+               };
+  auto forEachSide = [&](const std::function<void(size_t)> &f) {
+                       if (nthreads <= 1) {
+                         for (size_t i = 0; i < n_; ++i)
+                           f(i);
+                       } else {
+                         std::atomic<size_t> next_side(0);
+                         std::vector<std::thread> workers;
+                         for (size_t t = 0; t < nthreads; ++t)
+                           workers.emplace_back([&]() {
+                                                  for (size_t i = next_side++; i < n_;
+                                                       i = next_side++)
+                                                    f(i);
+                                                });
+                         for (auto &w : workers)
+                           w.join();
+                       }
+                     };
+
+  size_t first_level = std::max<size_t>(progress_level_, 3);
+  if (progress_ && first_level < levels_) {
+    // Progressive solve: all sides level by level, with the same grid hierarchy as solve()
+    auto progressive = [&](auto zero) {
+                         using T = decltype(zero);
+                         std::vector<std::vector<BasicHarmonicMap<T>>> pyramids(n_);
+                         forEachSide([&](size_t i) {
+                                       auto &grids = pyramids[i];
+                                       grids.resize(levels_ + 1);
+                                       grids[levels_] = initSide<T>(i);
+                                       for (size_t l = levels_; l > first_level; --l)
+                                         restrictGrid(grids[l], l, grids[l-1]);
+                                     });
+                         for (size_t level = first_level; level <= levels_; ++level) {
+                           forEachSide([&](size_t i) {
+                                         auto &grids = pyramids[i];
+                                         if (level == first_level)
+                                           solve(grids[level], level);
+                                         else {
+                                           prolongGrid(grids[level-1], level, grids[level]);
+                                           relax(grids[level], level);
+                                           grids[level-1] = BasicHarmonicMap<T>();
+                                         }
+                                       });
+                           size_ = std::pow(2, level);
+                           clear();
+                           if (stored_.cubic)
+                             rings_ = outsideRings(pyramids[0][level], size_);
+                           forEachSide([&](size_t i) { storeSide(i, pyramids[i][level]); });
+                           if (level < levels_)
+                             progress_(level);
+                         }
+                       };
+    if (stored_.precision == Precision::SINGLE)
+      progressive(0.0f);
+    else
+      progressive(0.0);
+    return;
+  }
+
+  clear();
+  if (stored_.cubic) {
+    std::vector<bool> boundary(size_ * size_, false);
+    for (const auto &cell : boundary_)
+      boundary[cell.index] = true;
+    rings_ = outsideRings(boundary, size_);
+  }
+  if (lazy_)
+    solved_ = std::make_unique<std::once_flag[]>(n_); // see ensureSide()
+  else
+    forEachSide([&](size_t i) { solveAndStore(i); });
+}
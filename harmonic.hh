@@ -1,23 +1,129 @@
 #pragma once
 
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+
 #include <parameterization.hh>
 
+#include "differentiable-parameterization.hh"
+#include "grid-storage.hh"
+
 using namespace Geometry;
 using Transfinite::Parameterization;
 
-struct GridValue {
+template<typename T>
+struct BasicGridValue {
   bool boundary;
-  double value;
+  T value;
 };
-using HarmonicMap = std::vector<GridValue>;
+template<typename T>
+using BasicHarmonicMap = std::vector<BasicGridValue<T>>;
+using GridValue = BasicGridValue<double>;
+using HarmonicMap = BasicHarmonicMap<double>;
 
-class Harmonic : public Parameterization {
+class Harmonic : public Parameterization, public DifferentiableParameterization {
 public:
+  // Storage of the solved maps and of the grids during relaxation:
+  // - DOUBLE: double everywhere
+  // - SINGLE_STORAGE: relaxation in double, the solved maps are stored as float
+  // - SINGLE: float storage also in the relaxation (the neighbour sums of each sweep are
+  //   accumulated in double, but every sweep rounds the relaxed values to float)
+  // The values are in [0, 1], so float storage alone rounds them by less than 6e-8;
+  // float relaxation may stop at a slightly different solution. Maximal deviations
+  // of (s, d) from DOUBLE, on synthetic 3-, 5- and 6-sided curved patches at levels
+  // 7, 9 and 11, with both interpolations:
+  // - SINGLE_STORAGE: |ds| < 5e-7, |dd| < 1e-7
+  // - SINGLE: |ds| < 7e-7, |dd| < 2e-7
+  // (s divides by the small map values near the corners, so it deviates more than d).
+  // Other patches can be measured with `curved-patch --precision-check`.
+  enum class Precision { DOUBLE, SINGLE_STORAGE, SINGLE };
+  // Interpolation of the grid values in mapToRibbon:
+  // - BILINEAR: C0 between grid cells
+  // - BICUBIC: Catmull-Rom, C1 everywhere; the stencils near the boundary read the nodes
+  //   just outside it extrapolated from the inside, and the gradients are the derivatives
+  //   of the cubic (precomputed gradient fields are not used)
+  enum class Interpolation { BILINEAR, BICUBIC };
+
   Harmonic(size_t levels);
   virtual ~Harmonic();
   virtual Point2D mapToRibbon(size_t i, const Point2D &uv) const override;
+  // (s, d) with its derivatives by u (der[0]) and by v (der[1]), using the
+  // bilinearly interpolated central differences of the grid (or the bicubic derivatives)
+  virtual Point2D mapToRibbonDerivatives(size_t i, const Point2D &uv,
+                                         Vector2DVector &der) const override;
   virtual void update() override;
+  void setThreads(size_t threads); // for solving the sides in parallel
+  // Choose the grid level in update() from the boundary features of the patch,
+  // such that the parameterization error is around target_error (0 turns it off)
+  void setAutoLevels(double target_error);
+  size_t levels() const;
+  void setPrecision(Precision precision); // takes effect in the next update()
+  Precision precision() const;
+  void setInterpolation(Interpolation interpolation); // takes effect in the next update()
+  Interpolation interpolation() const;
+  // Store the gradient fields in update(), instead of differencing the maps on each query
+  void setGradients(bool precompute);
+  // Solve the map of a side only when it is first needed (by mapToRibbon of this side
+  // or of the next one), instead of all sides in update(); thread-safe.
+  // Takes effect in the next update(), which still rasterizes the boundary of all sides.
+  // The lazy solves run on the threads calling mapToRibbon, but one at a time, so they
+  // need no more solver memory than a single-threaded update (see setMemoryBudget).
+  // They use the settings of the last update(). Not used in progressive updates.
+  void setLazy(bool lazy);
+  // Progressive update: solve all sides together, level by level from first_level,
+  // and call progress(level) when the maps of each coarser level are ready to be evaluated
+  // (the final level is available when update() returns). An empty function turns it off.
+  void setProgress(size_t first_level, std::function<void(size_t)> progress);
+  // Limit for the memory of update() (maps, gradients, solver grids), 0 for no limit.
+  // Each parameterization has its own budget. The coarser solver grids stay allocated
+  // per thread after update(), for reuse by the next solve on that thread; they are
+  // counted in the solver peak of the update, but not afterwards.
+  void setMemoryBudget(size_t bytes, BudgetPolicy policy);
+  // Grids, caches and the solver peak of the last update
+  MemoryUsage memoryUsage() const;
 private:
-  size_t levels_, size_;
-  std::vector<HarmonicMap> maps_;
+  // A grid cell on the rasterized boundary, with the curve parameter it belongs to
+  struct BoundaryCell {
+    size_t index, curve;
+    double u;
+  };
+  // Settings of the stored maps, fixed in update(); the setters only affect the next update
+  struct Storage {
+    Precision precision;
+    bool cubic;
+    bool gradients;             // precomputed gradient fields
+  };
+
+  double interpolate(size_t j, const Point2D &uv) const;
+  Vector2D interpolateGradient(size_t j, const Point2D &uv) const;
+  void rasterizeBoundary();
+  template<typename T> BasicHarmonicMap<T> initSide(size_t i) const;
+  template<typename T> BasicHarmonicMap<T> solveSide(size_t i) const;
+  template<typename T> void storeSide(size_t i, const BasicHarmonicMap<T> &m);
+  void solveAndStore(size_t i);
+  void ensureSide(size_t i) const;
+  size_t gridMemory(size_t levels) const;
+  size_t solverMemory(size_t levels, size_t threads) const;
+  void fitBudget(size_t &threads, bool &spill);
+
+  size_t requested_levels_, levels_, size_, threads_;
+  double target_error_;
+  Precision precision_;
+  Storage stored_;
+  Interpolation interpolation_;
+  bool precompute_gradients_;
+  size_t memory_budget_, solver_memory_;
+  BudgetPolicy budget_policy_;
+  size_t progress_level_;
+  std::function<void(size_t)> progress_;
+  bool lazy_, spill_;
+  std::unique_ptr<std::once_flag[]> solved_; // per side, in lazy mode
+  mutable std::mutex lazy_mutex_; // serializes the lazy solves
+  std::vector<GridStorage<double>> maps_;
+  std::vector<GridStorage<float>> float_maps_;
+  std::vector<GridStorage<float>> gradients_; // d/du and d/dv of each map, in grid units
+  std::vector<BoundaryCell> boundary_; // shared by all sides, in drawing order
+  std::vector<uint8_t> rings_;  // nodes outside the domain, see outsideRings() (bicubic only)
 };
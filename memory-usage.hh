@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstddef>
+
+// Approximate heap memory held by the parameterization data of a surface, in bytes
+struct MemoryUsage {
+  size_t grids = 0;             // solved harmonic maps and gradient fields (in memory)
+  size_t spilled = 0;           // ... the same, in memory-mapped temporary files
+  size_t meshes = 0;            // domain mesh and its parameters
+  size_t caches = 0;            // rasterized boundary, stencil masks
+  size_t solver = 0;            // estimated peak of the solver grids in the last update
+  size_t total() const { return grids + meshes + caches; }
+};
+
+// What to do when the parameterization would not fit into its memory budget:
+// - REFUSE: throw std::runtime_error
+// - DOWNGRADE: use coarser grids until it fits (throws when the coarsest does not fit)
+// - SPILL: keep the solved maps in temporary files, paged in on demand,
+//   and solve the sides one at a time (throws when a single solve does not fit)
+enum class BudgetPolicy { REFUSE, DOWNGRADE, SPILL };
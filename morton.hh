@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstddef>
+
+// Z-order (Morton) indexing of 2D grids
+namespace Morton {
+
+// Spreads the lower 16 bits of x to the even bits
+inline size_t spreadBits(size_t x) {
+  x &= 0xffff;
+  x = (x | (x << 8)) & 0x00ff00ff;
+  x = (x | (x << 4)) & 0x0f0f0f0f;
+  x = (x | (x << 2)) & 0x33333333;
+  x = (x | (x << 1)) & 0x55555555;
+  return x;
+}
+
+// Position of (u, v) in Z-order, for u, v < 2^16
+inline size_t index(size_t u, size_t v) {
+  return spreadBits(u) | (spreadBits(v) << 1);
+}
+
+}
@@ -0,0 +1,59 @@
+#include "output-queue.hh"
+
+OutputQueue::OutputQueue(size_t max_bytes)
+  : max_bytes_(max_bytes), pending_bytes_(0), running_(false), stop_(false)
+{
+  if (max_bytes_ > 0)
+    thread_ = std::thread(&OutputQueue::writer, this);
+}
+
+OutputQueue::~OutputQueue() {
+  if (!thread_.joinable())
+    return;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  changed_.notify_all();
+  thread_.join();
+}
+
+void
+OutputQueue::push(size_t bytes, std::function<void()> job) {
+  if (max_bytes_ == 0) {
+    job();
+    return;
+  }
+  std::unique_lock<std::mutex> lock(mutex_);
+  // A job larger than the budget is still accepted, but only into an empty queue
+  changed_.wait(lock, [&]() { return pending_bytes_ == 0 || pending_bytes_ + bytes <= max_bytes_; });
+  pending_bytes_ += bytes;
+  jobs_.push_back({ bytes, std::move(job) });
+  lock.unlock();
+  changed_.notify_all();
+}
+
+void
+OutputQueue::wait() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  changed_.wait(lock, [&]() { return jobs_.empty() && !running_; });
+}
+
+void
+OutputQueue::writer() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    changed_.wait(lock, [&]() { return stop_ || !jobs_.empty(); });
+    if (jobs_.empty())
+      return;                   // stopped
+    auto job = std::move(jobs_.front());
+    jobs_.pop_front();
+    running_ = true;
+    lock.unlock();
+    job.run();
+    lock.lock();
+    running_ = false;
+    pending_bytes_ -= job.bytes;
+    changed_.notify_all();
+  }
+}
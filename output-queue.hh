@@ -0,0 +1,33 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+// Background writer for output files.
+// Jobs run in FIFO order on a single thread; `push` blocks while the data held by
+// pending jobs (as estimated by the caller) exceeds the budget, so memory stays bounded.
+// With a zero budget the jobs run immediately in the calling thread.
+class OutputQueue {
+public:
+  OutputQueue(size_t max_bytes);
+  ~OutputQueue();               // waits for the pending jobs
+  void push(size_t bytes, std::function<void()> job);
+  void wait();                  // until all pushed jobs are done
+private:
+  struct Job {
+    size_t bytes;
+    std::function<void()> run;
+  };
+
+  void writer();
+
+  size_t max_bytes_, pending_bytes_;
+  bool running_, stop_;
+  std::deque<Job> jobs_;
+  std::mutex mutex_;
+  std::condition_variable changed_;
+  std::thread thread_;
+};
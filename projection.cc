@@ -0,0 +1,237 @@
+#include "projection.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <limits>
+#include <thread>
+
+#include "curved-domain.hh"
+
+namespace {
+
+  const size_t leaf_size = 4;
+
+  double boxDistance(const Point3D &p, const Point3D &min, const Point3D &max) {
+    double result = 0.0;
+    for (size_t i = 0; i < 3; ++i) {
+      double d = std::max({ min[i] - p[i], 0.0, p[i] - max[i] });
+      result += d * d;
+    }
+    return result;
+  }
+
+  // Closest point of the triangle abc to p, as barycentric coordinates
+  // (C. Ericson, Real-Time Collision Detection, Section 5.1.5)
+  Point3D closestBarycentric(const Point3D &p, const Point3D &a, const Point3D &b,
+                             const Point3D &c) {
+    Vector3D ab = b - a, ac = c - a, ap = p - a;
+    double d1 = ab * ap, d2 = ac * ap;
+    if (d1 <= 0.0 && d2 <= 0.0)
+      return { 1, 0, 0 };
+    Vector3D bp = p - b;
+    double d3 = ab * bp, d4 = ac * bp;
+    if (d3 >= 0.0 && d4 <= d3)
+      return { 0, 1, 0 };
+    double vc = d1 * d4 - d3 * d2;
+    if (vc <= 0.0 && d1 >= 0.0 && d3 <= 0.0) {
+      double v = d1 / (d1 - d3);
+      return { 1 - v, v, 0 };
+    }
+    Vector3D cp = p - c;
+    double d5 = ab * cp, d6 = ac * cp;
+    if (d6 >= 0.0 && d5 <= d6)
+      return { 0, 0, 1 };
+    double vb = d5 * d2 - d1 * d6;
+    if (vb <= 0.0 && d2 >= 0.0 && d6 <= 0.0) {
+      double w = d2 / (d2 - d6);
+      return { 1 - w, 0, w };
+    }
+    double va = d3 * d6 - d5 * d4;
+    if (va <= 0.0 && d4 - d3 >= 0.0 && d5 - d6 >= 0.0) {
+      double w = (d4 - d3) / ((d4 - d3) + (d5 - d6));
+      return { 0, 1 - w, w };
+    }
+    double denom = 1.0 / (va + vb + vc);
+    double v = vb * denom, w = vc * denom;
+    return { 1 - v - w, v, w };
+  }
+
+}
+
+Projection::Projection(const std::shared_ptr<const CurvedSurface> &surface, size_t resolution)
+  : surface_(surface)
+{
+  auto mesh = surface->eval(resolution);
+  uvs_ = surface->domain()->parameters(resolution);
+  points_ = mesh.points();
+  for (const auto &t : mesh.triangles())
+    triangles_.push_back({ t[0], t[1], t[2] });
+  nodes_.reserve(2 * triangles_.size() / leaf_size + 1);
+  if (!triangles_.empty())
+    build(0, triangles_.size());
+
+  // Parameter box: the boundary curves lie in the box of their control points
+  Point2DVector corners = uvs_;
+  if (auto curved = dynamic_cast<const CurvedDomain *>(surface->domain().get()))
+    for (const auto &c : curved->boundaries())
+      for (const auto &p : c.controlPoints())
+        corners.emplace_back(p[0], p[1]);
+  min_uv_ = max_uv_ = corners.empty() ? Point2D(0, 0) : corners[0];
+  for (const auto &uv : corners)
+    for (size_t k = 0; k < 2; ++k) {
+      min_uv_[k] = std::min(min_uv_[k], uv[k]);
+      max_uv_[k] = std::max(max_uv_[k], uv[k]);
+    }
+}
+
+Point2D
+Projection::clampToDomain(const Point2D &uv) const {
+  return Point2D(std::clamp(uv[0], min_uv_[0], max_uv_[0]),
+                 std::clamp(uv[1], min_uv_[1], max_uv_[1]));
+}
+
+size_t
+Projection::build(size_t first, size_t count) {
+  size_t index = nodes_.size();
+  nodes_.emplace_back();
+  Point3D min = points_[triangles_[first][0]], max = min;
+  Point3D cmin(1e300, 1e300, 1e300), cmax(-1e300, -1e300, -1e300);
+  for (size_t i = first; i < first + count; ++i) {
+    Point3D centroid(0, 0, 0);
+    for (size_t j : triangles_[i]) {
+      const auto &p = points_[j];
+      for (size_t k = 0; k < 3; ++k) {
+        min[k] = std::min(min[k], p[k]);
+        max[k] = std::max(max[k], p[k]);
+      }
+      centroid += p / 3.0;
+    }
+    for (size_t k = 0; k < 3; ++k) {
+      cmin[k] = std::min(cmin[k], centroid[k]);
+      cmax[k] = std::max(cmax[k], centroid[k]);
+    }
+  }
+  nodes_[index].min = min;
+  nodes_[index].max = max;
+  nodes_[index].first = first;
+  nodes_[index].count = count;
+  if (count <= leaf_size)
+    return index;
+
+  // Median split along the longest axis of the centroids
+  size_t axis = 0;
+  for (size_t k = 1; k < 3; ++k)
+    if (cmax[k] - cmin[k] > cmax[axis] - cmin[axis])
+      axis = k;
+  auto centroid = [&](const std::array<size_t, 3> &t) {
+                    return points_[t[0]][axis] + points_[t[1]][axis] + points_[t[2]][axis];
+                  };
+  auto begin = triangles_.begin() + first, middle = begin + count / 2;
+  std::nth_element(begin, middle, begin + count,
+                   [&](const auto &a, const auto &b) { return centroid(a) < centroid(b); });
+  size_t left = build(first, count / 2);
+  size_t right = build(first + count / 2, count - count / 2);
+  nodes_[index].count = 0;
+  nodes_[index].left = left;
+  nodes_[index].right = right;
+  return index;
+}
+
+Point2D
+Projection::closestOnMesh(const Point3D &p) const {
+  double best = std::numeric_limits<double>::max();
+  Point2D result = uvs_.empty() ? Point2D(0, 0) : uvs_[0];
+  if (nodes_.empty())
+    return result;
+  std::vector<size_t> stack = { 0 };
+  while (!stack.empty()) {
+    const auto &node = nodes_[stack.back()];
+    stack.pop_back();
+    if (boxDistance(p, node.min, node.max) >= best)
+      continue;
+    if (node.count > 0) {
+      for (size_t i = node.first; i < node.first + node.count; ++i) {
+        const auto &t = triangles_[i];
+        auto bary = closestBarycentric(p, points_[t[0]], points_[t[1]], points_[t[2]]);
+        auto q = points_[t[0]] * bary[0] + points_[t[1]] * bary[1] + points_[t[2]] * bary[2];
+        double dist = (q - p).normSqr();
+        if (dist < best) {
+          best = dist;
+          result = uvs_[t[0]] * bary[0] + uvs_[t[1]] * bary[1] + uvs_[t[2]] * bary[2];
+        }
+      }
+      continue;
+    }
+    // Visit the closer child first
+    const auto &l = nodes_[node.left], &r = nodes_[node.right];
+    size_t left = node.left, right = node.right;
+    if (boxDistance(p, l.min, l.max) < boxDistance(p, r.min, r.max))
+      std::swap(left, right);
+    stack.push_back(left);
+    stack.push_back(right);
+  }
+  return result;
+}
+
+Point2D
+Projection::refine(const Point3D &p, Point2D uv) const {
+  // Gauss-Newton iterations on |S(u,v) - p|^2, with step halving;
+  // all evaluated points are clamped into the parameter box of the domain
+  const size_t max_iterations = 10;
+  uv = clampToDomain(uv);
+  Vector3D du, dv;
+  Point3D q = surface_->eval(uv, du, dv);
+  double dist = (q - p).normSqr();
+  for (size_t iter = 0; iter < max_iterations; ++iter) {
+    Vector3D r = p - q;
+    double a = du * du, b = du * dv, c = dv * dv, det = a * c - b * b;
+    if (std::abs(det) < epsilon)
+      break;
+    double ru = du * r, rv = dv * r;
+    Vector2D step((c * ru - b * rv) / det, (a * rv - b * ru) / det);
+    bool improved = false;
+    for (size_t k = 0; k < 5; ++k, step *= 0.5) {
+      Point2D uv1 = clampToDomain(uv + step);
+      if ((uv1 - uv).norm() < 1.0e-10)
+        break;
+      Vector3D du1, dv1;
+      Point3D q1 = surface_->eval(uv1, du1, dv1);
+      double dist1 = (q1 - p).normSqr();
+      if (dist1 < dist) {
+        uv = uv1;
+        q = q1; du = du1; dv = dv1;
+        dist = dist1;
+        improved = true;
+        break;
+      }
+    }
+    if (!improved || step.norm() < 1.0e-10)
+      break;
+  }
+  return uv;
+}
+
+Point2D
+Projection::project(const Point3D &p) const {
+  return refine(p, closestOnMesh(p));
+}
+
+Point2DVector
+Projection::project(const PointVector &points, size_t threads) const {
+  const size_t chunk = 256;
+  Point2DVector result(points.size());
+  std::atomic<size_t> next_chunk(0);
+  auto work = [&]() {
+                for (size_t start = chunk * next_chunk++; start < points.size();
+                     start = chunk * next_chunk++)
+                  for (size_t i = start, end = std::min(start + chunk, points.size()); i < end; ++i)
+                    result[i] = project(points[i]);
+              };
+  std::vector<std::thread> pool;
+  for (size_t t = 1; t < threads; ++t)
+    pool.emplace_back(work);
+  work();
+  for (auto &t : pool)
+    t.join();
+  return result;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <array>
+
+#include "curved-surface.hh"
+
+// Closest point queries on a curved surface.
+// A bounding volume hierarchy over the evaluated mesh gives the closest triangle,
+// whose interpolated domain point is then refined by Newton iterations on the surface.
+class Projection {
+public:
+  Projection(const std::shared_ptr<const CurvedSurface> &surface, size_t resolution);
+  // Domain point of the closest surface point (within the parameter box of the domain)
+  Point2D project(const Point3D &p) const;
+  // Parallel version for many points
+  Point2DVector project(const PointVector &points, size_t threads) const;
+
+private:
+  struct Node {
+    Point3D min, max;
+    size_t first, count;        // triangle range for leaves
+    size_t left, right;         // children otherwise
+  };
+
+  size_t build(size_t first, size_t count);
+  Point2D closestOnMesh(const Point3D &p) const;
+  Point2D refine(const Point3D &p, Point2D uv) const;
+  Point2D clampToDomain(const Point2D &uv) const;
+
+  std::shared_ptr<const CurvedSurface> surface_;
+  Point2DVector uvs_;
+  PointVector points_;
+  std::vector<std::array<size_t, 3>> triangles_;
+  std::vector<Node> nodes_;
+  Point2D min_uv_, max_uv_;
+};
@@ -0,0 +1,108 @@
+#include "tabulated-ribbon.hh"
+
+#include <algorithm>
+
+namespace {
+
+  // Cubic Hermite interpolation on [0, 1] with derivatives scaled to the segment length h
+  template<typename T>
+  T hermite(const T &p0, const T &d0, const T &p1, const T &d1, double h, double t) {
+    double t2 = t * t, t3 = t2 * t;
+    return p0 * (2.0 * t3 - 3.0 * t2 + 1.0) + d0 * ((t3 - 2.0 * t2 + t) * h) +
+      p1 * (-2.0 * t3 + 3.0 * t2) + d1 * ((t3 - t2) * h);
+  }
+
+}
+
+TabulatedRibbon::TabulatedRibbon(double tolerance) : tolerance_(tolerance) {
+}
+
+TabulatedRibbon::~TabulatedRibbon() {
+}
+
+void
+TabulatedRibbon::update() {
+  RibbonPerpendicular::update();
+  table_.clear();
+  const size_t min_segments = 16, max_segments = 4096;
+  for (size_t segments = min_segments; segments <= max_segments; segments *= 2) {
+    tabulate(segments);
+    if (maxError() < tolerance_)
+      break;
+  }
+}
+
+TabulatedRibbon::Sample
+TabulatedRibbon::exact(double s) const {
+  // The cross-derivative is differentiated numerically; the error of this
+  // is much smaller than the tolerances where a table makes sense
+  const double h = 1.0e-5;
+  Sample sample;
+  VectorVector der;
+  sample.point = curve_->eval(s, 1, der);
+  sample.dpoint = der[1];
+  sample.cross = RibbonPerpendicular::crossDerivative(s);
+  double s0 = std::max(s - h, 0.0), s1 = std::min(s + h, 1.0);
+  sample.dcross = (RibbonPerpendicular::crossDerivative(s1) -
+                   RibbonPerpendicular::crossDerivative(s0)) / (s1 - s0);
+  return sample;
+}
+
+void
+TabulatedRibbon::tabulate(size_t segments) {
+  table_.clear();
+  table_.reserve(segments + 1);
+  for (size_t k = 0; k <= segments; ++k)
+    table_.push_back(exact((double)k / segments));
+}
+
+double
+TabulatedRibbon::maxError() const {
+  size_t segments = table_.size() - 1;
+  double error = 0.0;
+  for (size_t k = 0; k < segments; ++k) {
+    double s = (k + 0.5) / segments;
+    Sample sample = exact(s);
+    Point3D point;
+    Vector3D cross;
+    lookup(s, point, cross);
+    error = std::max({ error, (point - sample.point).norm(), (cross - sample.cross).norm() });
+  }
+  return error;
+}
+
+void
+TabulatedRibbon::lookup(double s, Point3D &point, Vector3D &cross) const {
+  size_t segments = table_.size() - 1;
+  double x = s * segments;
+  size_t k = std::min<size_t>(x, segments - 1);
+  double t = x - k, h = 1.0 / segments;
+  const auto &a = table_[k], &b = table_[k+1];
+  point = hermite(a.point, a.dpoint, b.point, b.dpoint, h, t);
+  cross = hermite(a.cross, a.dcross, b.cross, b.dcross, h, t);
+}
+
+Vector3D
+TabulatedRibbon::crossDerivative(double s) const {
+  if (table_.empty() || s < 0.0 || s > 1.0)
+    return RibbonPerpendicular::crossDerivative(s);
+  Point3D point;
+  Vector3D cross;
+  lookup(s, point, cross);
+  return cross;
+}
+
+Point3D
+TabulatedRibbon::eval(const Point2D &sd) const {
+  if (table_.empty() || sd[0] < 0.0 || sd[0] > 1.0)
+    return RibbonPerpendicular::eval(sd);
+  Point3D point;
+  Vector3D cross;
+  lookup(sd[0], point, cross);
+  return point + cross * sd[1];
+}
+
+size_t
+TabulatedRibbon::tableSize() const {
+  return table_.size();
+}
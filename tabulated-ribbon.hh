@@ -0,0 +1,34 @@
+#pragma once
+
+#include <ribbon-perpendicular.hh>
+
+using namespace Geometry;
+using Transfinite::RibbonPerpendicular;
+
+// Perpendicular ribbon with the boundary curve and the cross-derivative sampled in update(),
+// and evaluated by cubic Hermite interpolation of the samples.
+// The sampling is refined until the interpolation error at the midpoints is below `tolerance`
+// (or the table reaches its maximal size).
+class TabulatedRibbon : public RibbonPerpendicular {
+public:
+  TabulatedRibbon(double tolerance);
+  virtual ~TabulatedRibbon();
+  virtual void update() override;
+  virtual Vector3D crossDerivative(double s) const override;
+  virtual Point3D eval(const Point2D &sd) const override;
+  size_t tableSize() const;
+
+private:
+  struct Sample {
+    Point3D point, cross;       // curve point and cross-derivative
+    Vector3D dpoint, dcross;    // ... and their derivatives by s
+  };
+
+  Sample exact(double s) const;
+  void tabulate(size_t segments);
+  double maxError() const;
+  void lookup(double s, Point3D &point, Vector3D &cross) const;
+
+  double tolerance_;
+  std::vector<Sample> table_;
+};